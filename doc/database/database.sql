@@ -19,10 +19,16 @@ CREATE INDEX tracks_sha1_index ON tracks(sha1);
 
 -- This table is only used to stored paths of a music file in case where
 -- there are several time the same file
+-- size, mtime, inode and device are the result of stat() when the file was
+-- scanned: if they have not changed, the sha1 is not computed again
 CREATE TABLE "files" (
 	`filename`	TEXT NOT NULL PRIMARY KEY,
 	`track_id`	INTEGER NOT NULL,
 	`timestamp`	INTEGER NOT NULL,
+	`size`	INTEGER NOT NULL DEFAULT 0,
+	`mtime`	INTEGER NOT NULL DEFAULT 0,
+	`inode`	INTEGER NOT NULL DEFAULT 0,
+	`device`	INTEGER NOT NULL DEFAULT 0,
 	FOREIGN KEY(track_id) REFERENCES tracks(id) ON DELETE CASCADE
 );
 
@@ -92,6 +98,22 @@ CREATE TABLE "authorized_clients" (
 	`username`	TEXT
 );
 
+-- Scan in progress, used to resume it after a restart. The scan keeps its
+-- start time (the timestamp of the files), the scanned directories (separated
+-- by '\n', empty for all the locations) and the directories already done.
+CREATE TABLE "scans" (
+	`id`	INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
+	`start_time`	INTEGER NOT NULL,
+	`scope`	TEXT
+);
+
+CREATE TABLE "scans_directories" (
+	`scan_id`	INTEGER NOT NULL,
+	`directory`	TEXT NOT NULL,
+	PRIMARY KEY (scan_id, directory),
+	FOREIGN KEY(scan_id) REFERENCES scans(id) ON DELETE CASCADE
+);
+
 -- Admin. config
 CREATE TABLE "configuration" (
 	`config_name`	TEXT NOT NULL PRIMARY KEY,
@@ -41,8 +41,17 @@ Application::Application(int & argc, char ** argv) :
     EMS_LOAD_SETTINGS(cacheDirPath, "main/cache_directory",
                       QStandardPaths::standardLocations(QStandardPaths::CacheLocation)[0], String);
 
-    /* Make sure the path exists */
-    QDir().mkpath(locations);
+    /* Make sure the paths exist */
+    QStringList locationList;
+    foreach (QString location, locations.split(EMS_LOCATIONS_SEPARATOR, QString::SkipEmptyParts))
+    {
+        location = QDir::cleanPath(location.trimmed());
+        if (!location.isEmpty() && !locationList.contains(location))
+        {
+            QDir().mkpath(location);
+            locationList << location;
+        }
+    }
     QDir().mkpath(cacheDirPath);
 
     /* Add online database plugins */
@@ -83,7 +92,10 @@ Application::Application(int & argc, char ** argv) :
     m_smartmontools = new SmartmontoolsNotifier(this);
 
     /* Scan locations to perform a database update */
-    m_directoriesWatcher.addLocation(locations);
+    foreach (const QString &location, locationList)
+    {
+        m_directoriesWatcher.addLocation(location);
+    }
     m_directoriesWatcher.start();
 
 }
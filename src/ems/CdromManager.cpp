@@ -285,7 +285,7 @@ CdromManager::CdromManager(QObject *parent) : QObject(parent),
 
     qRegisterMetaType<EMSCdrom>("EMSCdrom");
 
-    connect(this, SIGNAL(cdromTrackNeedUpdate(EMSTrack,QStringList)), MetadataManager::instance(), SLOT(update(EMSTrack,QStringList)), Qt::DirectConnection);
+    connect(this, SIGNAL(cdromTrackNeedUpdate(EMSTrack,QStringList)), MetadataManager::instance(), SLOT(update(EMSTrack,QStringList)), Qt::QueuedConnection);
     connect(MetadataManager::instance(), SIGNAL(updated(EMSTrack,bool)), this, SLOT(cdromTrackUpdated(EMSTrack,bool)));
 }
 
@@ -258,10 +258,10 @@ bool CdromRipper::buildAudioFilenames(unsigned int indexTrack)
     EMS_LOAD_SETTINGS(locations, "main/locations",
                       QStandardPaths::standardLocations(QStandardPaths::MusicLocation)[0],
                       String);
-    QStringList locationList = locations.split( " " );
+    QStringList locationList = locations.split(EMS_LOCATIONS_SEPARATOR, QString::SkipEmptyParts);
     if (locationList.size() > 0)
     {
-        mainDirectoryPath = locationList[0];
+        mainDirectoryPath = locationList[0].trimmed();
     }
 
     // Find the artist
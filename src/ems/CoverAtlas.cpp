@@ -0,0 +1,255 @@
+#include <QDebug>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThread>
+#include <QRunnable>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QPainter>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <math.h>
+
+#include "DefaultSettings.h"
+#include "CoverAtlas.h"
+#include "CoverStore.h"
+#include "Database.h"
+
+CoverAtlas* CoverAtlas::_instance = 0;
+
+class AtlasTask : public QRunnable
+{
+public:
+    AtlasTask(unsigned long long generation, int page, int size) :
+        m_generation(generation),
+        m_page(page),
+        m_size(size)
+    {
+    }
+
+    void run()
+    {
+        QString map = CoverAtlas::instance()->createAtlas(m_generation, m_page, m_size);
+        QMetaObject::invokeMethod(CoverAtlas::instance(), "atlasDone", Qt::QueuedConnection,
+                                  Q_ARG(unsigned long long, m_generation), Q_ARG(int, m_page),
+                                  Q_ARG(int, m_size), Q_ARG(QString, map));
+    }
+
+private:
+    unsigned long long m_generation;
+    int m_page;
+    int m_size;
+};
+
+CoverAtlas::CoverAtlas()
+{
+    QSettings settings;
+    QString cacheDirPath;
+    EMS_LOAD_SETTINGS(cacheDirPath, "main/cache_directory",
+                      QStandardPaths::standardLocations(QStandardPaths::CacheLocation)[0], String);
+    EMS_LOAD_SETTINGS(m_pageSize, "main/cover_atlas_page_size",
+                      EMS_COVER_ATLAS_PAGE_SIZE, Int);
+    EMS_LOAD_SETTINGS(m_quality, "main/thumbnail_quality",
+                      EMS_THUMBNAIL_QUALITY, Int);
+
+    if (m_pageSize < 1)
+    {
+        m_pageSize = 1;
+    }
+    m_atlasDir = cacheDirPath + QDir::separator() + "atlas";
+
+    /* An atlas decodes a whole page of covers: one at a time */
+    m_pool.setMaxThreadCount(1);
+
+    /* The results of the requests are handled by the event loop of the main thread */
+    moveToThread(QCoreApplication::instance()->thread());
+}
+
+QString CoverAtlas::atlasPath(unsigned long long generation, int page, int size)
+{
+    return m_atlasDir + QDir::separator() + QString::number(generation) +
+           QDir::separator() + QString("%1_%2").arg(size).arg(page);
+}
+
+void CoverAtlas::requestAtlas(unsigned long long generation, int page, int size)
+{
+    QString path = atlasPath(generation, page, size);
+
+    /* All the clients of the house open the same grid */
+    m_mutex.lock();
+    bool requested = m_requestedAtlases.contains(path);
+    m_requestedAtlases.insert(path);
+    m_mutex.unlock();
+
+    if (!requested)
+    {
+        m_pool.start(new AtlasTask(generation, page, size));
+    }
+}
+
+void CoverAtlas::atlasDone(unsigned long long generation, int page, int size, QString map)
+{
+    m_mutex.lock();
+    m_requestedAtlases.remove(atlasPath(generation, page, size));
+    m_mutex.unlock();
+    emit atlasReady(generation, page, size, map);
+}
+
+/* The covers are decoded at a reduced resolution (or from a thumbnail of
+ * the CoverStore), then cropped to a square. The map is written after the
+ * image: a map which exists always has its image.
+ * The albums may have changed since the request: the atlas is stored under
+ * the generation of the albums actually read. Return the path of its map,
+ * empty on error.
+ */
+QString CoverAtlas::createAtlas(unsigned long long requestedGeneration, int page, int size)
+{
+    QVector<EMSAlbum> albums;
+    Database *db = Database::instance();
+    db->lock();
+    unsigned long long generation = db->getAlbumsGeneration();
+    db->getAlbumsPage(&albums, (qint64)page * m_pageSize, m_pageSize);
+    db->unlock();
+
+    QString path = atlasPath(generation, page, size);
+    if (generation != requestedGeneration && QFile::exists(path + ".json"))
+    {
+        /* Already made for another client */
+        return path + ".json";
+    }
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    int columns = (int)ceil(sqrt((double)m_pageSize));
+    int rows = (albums.size() + columns - 1) / columns;
+    QJsonArray entries;
+    QJsonObject map;
+    map["generation"] = (qint64)generation;
+    map["page"] = page;
+    map["size"] = size;
+    map["columns"] = columns;
+
+    if (!albums.isEmpty())
+    {
+        QImage atlas(columns * size, rows * size, QImage::Format_RGB32);
+        atlas.fill(Qt::black);
+        QPainter painter(&atlas);
+
+        for (int i=0; i<albums.size(); i++)
+        {
+            const EMSAlbum &album = albums.at(i);
+            QJsonObject entry;
+            entry["id"] = (qint64)album.id;
+            entry["name"] = album.name;
+
+            QImage cover;
+            if (!album.cover.isEmpty())
+            {
+                QString thumbnail = CoverStore::thumbnailPath(album.cover, size);
+                QImageReader reader(QFile::exists(thumbnail) ? thumbnail : album.cover);
+                QSize imageSize = reader.size();
+                if (imageSize.isValid())
+                {
+                    QSize decodeSize = imageSize.scaled(size, size, Qt::KeepAspectRatioByExpanding);
+                    if (decodeSize.width() < imageSize.width())
+                    {
+                        reader.setScaledSize(decodeSize);
+                    }
+                }
+                cover = reader.read();
+            }
+
+            /* Albums without cover have no position */
+            if (!cover.isNull())
+            {
+                cover = cover.scaled(size, size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+                int x = (i % columns) * size;
+                int y = (i / columns) * size;
+                painter.drawImage(x, y, cover, (cover.width() - size) / 2, (cover.height() - size) / 2, size, size);
+                entry["x"] = x;
+                entry["y"] = y;
+            }
+            entries.append(entry);
+        }
+        painter.end();
+
+        QFile file(path + ".jpg.tmp");
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            qCritical() << "CoverAtlas: unable to write " << file.fileName();
+            return QString();
+        }
+        QImageWriter writer(&file, "jpg");
+        writer.setQuality(m_quality);
+        writer.setOptimizedWrite(true);
+        writer.setProgressiveScanWrite(true);
+        if (!writer.write(atlas))
+        {
+            qCritical() << "CoverAtlas: unable to encode " << path << ":" << writer.errorString();
+            file.remove();
+            return QString();
+        }
+        file.close();
+        QFile::remove(path + ".jpg");
+        if (!file.rename(path + ".jpg"))
+        {
+            file.remove();
+            return QString();
+        }
+
+        /* Relative to the root of the HTTP server */
+        map["image"] = QString("/atlas/%1/%2_%3.jpg").arg(generation).arg(size).arg(page);
+    }
+    map["albums"] = entries;
+
+    QFile file(path + ".json.tmp");
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qCritical() << "CoverAtlas: unable to write " << file.fileName();
+        return QString();
+    }
+    file.write(QJsonDocument(map).toJson(QJsonDocument::Compact));
+    file.close();
+    QFile::remove(path + ".json");
+    if (!file.rename(path + ".json"))
+    {
+        file.remove();
+        return QString();
+    }
+
+    qDebug() << "CoverAtlas: page" << page << "of" << albums.size() << "albums at" << size << "pixels";
+    removeOldGenerations(generation);
+    return path + ".json";
+}
+
+/* The atlases of the old generations show old albums. The previous
+ * generation is kept: a client may have just received one of its maps and
+ * still have to load the image.
+ */
+void CoverAtlas::removeOldGenerations(unsigned long long generation)
+{
+    QDir atlasDir(m_atlasDir);
+    QStringList names = atlasDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    unsigned long long previous = 0;
+    foreach (const QString &name, names)
+    {
+        unsigned long long oldGeneration = name.toULongLong();
+        if (oldGeneration < generation && oldGeneration > previous)
+        {
+            previous = oldGeneration;
+        }
+    }
+
+    foreach (const QString &name, names)
+    {
+        if (name.toULongLong() < previous)
+        {
+            QDir(atlasDir.filePath(name)).removeRecursively();
+        }
+    }
+}
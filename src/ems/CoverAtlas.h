@@ -0,0 +1,85 @@
+#ifndef COVERATLAS_H
+#define COVERATLAS_H
+
+#include <QObject>
+#include <QString>
+#include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+
+/* Sprite sheets of the album covers, for the album grids of the clients.
+ * The albums of library://music/albums are cut in pages of
+ * main/cover_atlas_page_size albums. The atlas of a page is one JPEG image
+ * with the covers of the page (size x size pixels each, row by row), and a
+ * JSON map gives the position of each album in the image:
+ * <cache>/atlas/<generation>/<size>_<page>.jpg and .json
+ * The generation is the one of the albums in the database
+ * (Database::getAlbumsGeneration): a new album or a new cover makes new
+ * atlases, the ones before the previous generation are removed.
+ * The atlases are made on request by one thread, out of the event loop.
+ */
+class CoverAtlas : public QObject
+{
+    Q_OBJECT
+public:
+    /* Thread safe API */
+
+    /* Number of albums by atlas */
+    int pageSize() const { return m_pageSize; }
+
+    /* Path of an atlas, without the extension */
+    QString atlasPath(unsigned long long generation, int page, int size);
+
+    /* Make an atlas for a client which waits for it, atlasReady() is
+     * emitted by the main thread when it is done. The map may be the one
+     * of a newer generation.
+     */
+    void requestAtlas(unsigned long long generation, int page, int size);
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static CoverAtlas* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new CoverAtlas;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+signals:
+    /* map is empty if the atlas can't be made */
+    void atlasReady(unsigned long long generation, int page, int size, QString map);
+
+private slots:
+    void atlasDone(unsigned long long generation, int page, int size, QString map);
+
+private:
+    QString m_atlasDir;
+    int m_pageSize;
+    int m_quality;
+    QThreadPool m_pool;
+
+    /* Atlases being made, protected by m_mutex */
+    QMutex m_mutex;
+    QSet<QString> m_requestedAtlases;
+
+    QString createAtlas(unsigned long long requestedGeneration, int page, int size);
+    void removeOldGenerations(unsigned long long generation);
+
+    friend class AtlasTask;
+
+    static CoverAtlas* _instance;
+    CoverAtlas();
+    CoverAtlas(const CoverAtlas &);
+    CoverAtlas& operator=(const CoverAtlas &);
+};
+
+#endif // COVERATLAS_H
@@ -1,28 +1,18 @@
-#include <QFile>
 #include <QDebug>
-#include <QDir>
-#include <QSettings>
-#include <QStandardPaths>
+#include <QFileInfo>
+#include <taglib/flacfile.h>
+#include <taglib/flacpicture.h>
+#include <taglib/mpegfile.h>
+#include <taglib/id3v2tag.h>
+#include <taglib/attachedpictureframe.h>
 
-#include "DefaultSettings.h"
+#include "CoverStore.h"
 #include "CoverLocalPlugin.h"
 
 
 CoverLocalPlugin::CoverLocalPlugin()
 {
-    QSettings settings;
     capabilities << "cover";
-
-    /* Download directory */
-    QString cacheDirPath;
-    EMS_LOAD_SETTINGS(cacheDirPath, "main/cache_directory",
-                      QStandardPaths::standardLocations(QStandardPaths::CacheLocation)[0], String);
-    QDir cacheDir(cacheDirPath);
-    cacheDir.mkpath("local");
-    QDir localCoverCacheDir(cacheDirPath + QDir::separator() + "local");
-    localCoverCacheDir.mkdir("albums");
-    m_albumsCacheDir = cacheDirPath + QDir::separator() + "local" + QDir::separator() + "albums";
-    m_cacheDirPath = cacheDirPath;
 }
 
 CoverLocalPlugin::~CoverLocalPlugin()
@@ -47,33 +37,93 @@ bool CoverLocalPlugin::update(EMSTrack *track)
         track->artists.append(artist);
     }
 #endif
-    QStringList lookup;
-
-    // Search for specific file, preference for png
-    lookup << "cover.png" << "folder.png" << "front.png" << "cover.jpg" << "folder.jpg" << "front.jpg";
+    /* Only the first track of the directory looks for the cover file */
+    CoverStore *store = CoverStore::instance();
+    QString cover;
+    if (!store->cachedDirectoryCover(albumDirectory, &cover))
+    {
+        cover = store->findDirectoryCover(albumDirectory);
+        store->setDirectoryCover(albumDirectory, cover);
+    }
 
-    foreach(QString filename, lookup)
+    /* Without cover file, each album of the directory has its own picture.
+     * A track without picture doesn't mean that the next ones have none.
+     */
+    if (cover.isEmpty() && !store->cachedEmbeddedCover(albumDirectory, track->album.name, &cover))
     {
-        QString f =  QFileInfo(track->filename).absolutePath() + QDir::separator() +  filename;
-        if (QFile::exists(f))
+        cover = embeddedCover(track->filename);
+        if (!cover.isEmpty())
         {
-            QString coverName = track->album.name.simplified();
-            // FIXME : http server is not able to serve file with space in the name
-            // remove space for now
-            coverName = coverName.replace(" ", "");
-            coverName +=  "_";
-            coverName +=  filename;
-            QString newFile = m_albumsCacheDir + QDir::separator() + coverName;
-            // Copy, found file in cache directory
-            QFile::copy(f, newFile);
-
-            // Set the cover of album
-            track->album.cover = newFile;
-            return true;
+            store->setEmbeddedCover(albumDirectory, track->album.name, cover);
         }
     }
-
+    if (!cover.isEmpty())
+    {
+        // Set the cover of album
+        track->album.cover = cover;
+    }
 
     return true;
 }
 
+
+/* Store the front cover (or the first picture) embedded in a FLAC or MP3 file */
+QString CoverLocalPlugin::embeddedCover(const QString &filename)
+{
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    QByteArray image;
+    QString mimeType;
+
+    if (suffix == "flac")
+    {
+        TagLib::FLAC::File file(filename.toUtf8().data(), false);
+        if (!file.isValid())
+        {
+            return QString();
+        }
+
+        TagLib::List<TagLib::FLAC::Picture *> pictures = file.pictureList();
+        for (TagLib::List<TagLib::FLAC::Picture *>::ConstIterator it = pictures.begin(); it != pictures.end(); ++it)
+        {
+            if (image.isEmpty() || (*it)->type() == TagLib::FLAC::Picture::FrontCover)
+            {
+                image = QByteArray((*it)->data().data(), (*it)->data().size());
+                mimeType = TStringToQString((*it)->mimeType());
+            }
+            if ((*it)->type() == TagLib::FLAC::Picture::FrontCover)
+            {
+                break;
+            }
+        }
+    }
+    else if (suffix == "mp3")
+    {
+        TagLib::MPEG::File file(filename.toUtf8().data(), false);
+        if (!file.isValid() || !file.ID3v2Tag())
+        {
+            return QString();
+        }
+
+        TagLib::ID3v2::FrameList frames = file.ID3v2Tag()->frameListMap()["APIC"];
+        for (TagLib::ID3v2::FrameList::ConstIterator it = frames.begin(); it != frames.end(); ++it)
+        {
+            TagLib::ID3v2::AttachedPictureFrame *frame = static_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
+            if (image.isEmpty() || frame->type() == TagLib::ID3v2::AttachedPictureFrame::FrontCover)
+            {
+                image = QByteArray(frame->picture().data(), frame->picture().size());
+                mimeType = TStringToQString(frame->mimeType());
+            }
+            if (frame->type() == TagLib::ID3v2::AttachedPictureFrame::FrontCover)
+            {
+                break;
+            }
+        }
+    }
+
+    if (image.isEmpty())
+    {
+        return QString();
+    }
+
+    return CoverStore::instance()->store(image, (mimeType == "image/png") ? "png" : "jpg");
+}
@@ -5,7 +5,9 @@
 #include "Data.h"
 
 /* The CoverLocal Plugin search for cover files in the same directory where the
- * track is saved.
+ * track is saved, or for the picture embedded in the tracks (FLAC and MP3).
+ * A cover file is stored once for all the tracks of the directory, an
+ * embedded picture once for the tracks of the same album (see CoverStore).
  */
 
 class CoverLocalPlugin : public MetadataPlugin
@@ -19,8 +21,6 @@ public:
     bool update(EMSTrack *track);
 
 private:
-    /* Cache directories */
-    QString m_albumsCacheDir;
-    QString m_cacheDirPath;
+    QString embeddedCover(const QString &filename);
 };
 #endif // COVERLOCALPLUGIN_H
@@ -0,0 +1,328 @@
+#include <QDebug>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QThread>
+#include <QRunnable>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+
+#include "DefaultSettings.h"
+#include "CoverStore.h"
+
+CoverStore* CoverStore::_instance = 0;
+
+class ThumbnailTask : public QRunnable
+{
+public:
+    ThumbnailTask(const QString &path, const QList<int> &sizes) :
+        m_path(path),
+        m_sizes(sizes)
+    {
+    }
+
+    void run()
+    {
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+        foreach (int size, m_sizes)
+        {
+            if (!QFile::exists(CoverStore::thumbnailPath(m_path, size)))
+            {
+                CoverStore::createThumbnail(m_path, size);
+            }
+        }
+    }
+
+private:
+    QString m_path;
+    QList<int> m_sizes;
+};
+
+class ThumbnailRequestTask : public QRunnable
+{
+public:
+    ThumbnailRequestTask(const QString &path, int size) :
+        m_path(path),
+        m_size(size)
+    {
+    }
+
+    void run()
+    {
+        bool done = CoverStore::createThumbnail(m_path, m_size);
+        QMetaObject::invokeMethod(CoverStore::instance(), "thumbnailDone", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_path), Q_ARG(int, m_size), Q_ARG(bool, done));
+    }
+
+private:
+    QString m_path;
+    int m_size;
+};
+
+CoverStore::CoverStore()
+{
+    QSettings settings;
+    QString cacheDirPath;
+    EMS_LOAD_SETTINGS(cacheDirPath, "main/cache_directory",
+                      QStandardPaths::standardLocations(QStandardPaths::CacheLocation)[0], String);
+
+    m_coversDir = cacheDirPath + QDir::separator() + "covers";
+    QDir().mkpath(m_coversDir);
+
+    QString thumbnailSizes;
+    EMS_LOAD_SETTINGS(thumbnailSizes, "main/cover_thumbnail_sizes",
+                      EMS_COVER_THUMBNAIL_SIZES, String);
+    foreach (const QString &size, thumbnailSizes.split(",", QString::SkipEmptyParts))
+    {
+        if (size.trimmed().toInt() > 0)
+        {
+            m_thumbnailSizes << size.trimmed().toInt();
+        }
+    }
+
+    /* Decoding images is slow: one thread is enough, the scan goes first */
+    m_thumbnailPool.setMaxThreadCount(1);
+
+    int requestWorkers;
+    EMS_LOAD_SETTINGS(requestWorkers, "main/thumbnail_workers",
+                      EMS_THUMBNAIL_WORKERS, Int);
+    m_requestPool.setMaxThreadCount(requestWorkers > 0 ? requestWorkers : 1);
+
+    EMS_LOAD_SETTINGS(m_thumbnailQuality, "main/thumbnail_quality",
+                      EMS_THUMBNAIL_QUALITY, Int);
+
+    /* The first call may come from a scan thread: the results of the
+     * requests are handled by the event loop of the main thread.
+     */
+    moveToThread(QCoreApplication::instance()->thread());
+}
+
+bool CoverStore::cachedDirectoryCover(const QString &directory, QString *cover)
+{
+    bool found;
+
+    m_mutex.lock();
+    QHash<QString, QString>::const_iterator it = m_directoryCovers.constFind(directory);
+    found = (it != m_directoryCovers.constEnd());
+    if (found)
+    {
+        *cover = it.value();
+    }
+    m_mutex.unlock();
+
+    return found;
+}
+
+void CoverStore::setDirectoryCover(const QString &directory, const QString &cover)
+{
+    m_mutex.lock();
+    m_directoryCovers.insert(directory, cover);
+    m_mutex.unlock();
+}
+
+bool CoverStore::cachedEmbeddedCover(const QString &directory, const QString &album, QString *cover)
+{
+    bool found;
+
+    m_mutex.lock();
+    QHash<QPair<QString, QString>, QString>::const_iterator it = m_embeddedCovers.constFind(qMakePair(directory, album));
+    found = (it != m_embeddedCovers.constEnd());
+    if (found)
+    {
+        *cover = it.value();
+    }
+    m_mutex.unlock();
+
+    return found;
+}
+
+void CoverStore::setEmbeddedCover(const QString &directory, const QString &album, const QString &cover)
+{
+    m_mutex.lock();
+    m_embeddedCovers.insert(qMakePair(directory, album), cover);
+    m_mutex.unlock();
+}
+
+QString CoverStore::findDirectoryCover(const QString &directory)
+{
+    QStringList lookup;
+
+    // Search for specific file, preference for png
+    lookup << "cover.png" << "folder.png" << "front.png" << "cover.jpg" << "folder.jpg" << "front.jpg";
+
+    foreach (const QString &filename, lookup)
+    {
+        QString f = directory + QDir::separator() + filename;
+        if (QFile::exists(f))
+        {
+            return storeFile(f);
+        }
+    }
+
+    return QString();
+}
+
+QString CoverStore::storeFile(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "CoverStore: unable to read " << filename;
+        return QString();
+    }
+
+    QByteArray image = file.readAll();
+    file.close();
+    return store(image, QFileInfo(filename).suffix());
+}
+
+QString CoverStore::store(const QByteArray &image, const QString &extension)
+{
+    if (image.isEmpty())
+    {
+        return QString();
+    }
+
+    QString hash = QCryptographicHash::hash(image, QCryptographicHash::Sha1).toHex();
+    QString dirPath = m_coversDir + QDir::separator() + hash.left(2);
+    QString path = dirPath + QDir::separator() + hash + "." + extension.toLower();
+
+    if (QFile::exists(path))
+    {
+        /* Already stored by another album */
+        return path;
+    }
+
+    /* Written in a temporary file of this thread first: a concurrent reader
+     * never sees a partial image
+     */
+    QDir().mkpath(dirPath);
+    QFile file(path + QString(".%1.tmp").arg((quintptr)QThread::currentThreadId()));
+    if (!file.open(QIODevice::WriteOnly) || file.write(image) != image.size())
+    {
+        qCritical() << "CoverStore: unable to write " << file.fileName();
+        file.remove();
+        return QString();
+    }
+    file.close();
+
+    if (!file.rename(path))
+    {
+        file.remove();
+        if (!QFile::exists(path))
+        {
+            qCritical() << "CoverStore: unable to store " << path;
+            return QString();
+        }
+    }
+
+    queueThumbnails(path);
+    return path;
+}
+
+void CoverStore::queueThumbnails(const QString &path)
+{
+    if (!m_thumbnailSizes.isEmpty())
+    {
+        m_thumbnailPool.start(new ThumbnailTask(path, m_thumbnailSizes));
+    }
+}
+
+void CoverStore::requestThumbnail(const QString &path, int size)
+{
+    QString thumbnail = thumbnailPath(path, size);
+
+    /* Several clients often want the same thumbnail (album grid) */
+    m_mutex.lock();
+    bool requested = m_requestedThumbnails.contains(thumbnail);
+    m_requestedThumbnails.insert(thumbnail);
+    m_mutex.unlock();
+
+    if (!requested)
+    {
+        m_requestPool.start(new ThumbnailRequestTask(path, size));
+    }
+}
+
+void CoverStore::thumbnailDone(QString path, int size, bool done)
+{
+    QString thumbnail = thumbnailPath(path, size);
+
+    m_mutex.lock();
+    m_requestedThumbnails.remove(thumbnail);
+    m_mutex.unlock();
+    emit thumbnailReady(path, size, done ? thumbnail : QString());
+}
+
+void CoverStore::clearDirectoryCache()
+{
+    m_mutex.lock();
+    m_directoryCovers.clear();
+    m_embeddedCovers.clear();
+    m_mutex.unlock();
+}
+
+QString CoverStore::thumbnailPath(const QString &path, int size)
+{
+    return path + QString("_resized_%1px").arg(size);
+}
+
+/* The image fills a square of size pixels, in the format of the original.
+ * Big images are decoded at a reduced resolution (the JPEG decoder scales
+ * in the DCT domain), twice the final size so that the smooth scaling
+ * keeps its quality. JPEG thumbnails are progressive, with the quality
+ * main/thumbnail_quality.
+ */
+bool CoverStore::createThumbnail(const QString &path, int size)
+{
+    QImageReader reader(path);
+    QSize imageSize = reader.size();
+    if (imageSize.isValid())
+    {
+        QSize decodeSize = imageSize.scaled(2*size, 2*size, Qt::KeepAspectRatioByExpanding);
+        if (decodeSize.width() < imageSize.width())
+        {
+            reader.setScaledSize(decodeSize);
+        }
+    }
+
+    QImage img = reader.read();
+    if (img.isNull())
+    {
+        qDebug() << "CoverStore: unable to decode " << path << ":" << reader.errorString();
+        return false;
+    }
+
+    QString thumbnail = thumbnailPath(path, size);
+    QFile file(thumbnail + QString(".%1.tmp").arg((quintptr)QThread::currentThreadId()));
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qCritical() << "CoverStore: unable to write " << file.fileName();
+        return false;
+    }
+
+    img = img.scaled(size, size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    QImageWriter writer(&file, QFileInfo(path).suffix().toLower().toLatin1());
+    writer.setQuality(instance()->m_thumbnailQuality);
+    writer.setOptimizedWrite(true);
+    writer.setProgressiveScanWrite(true);
+    if (!writer.write(img))
+    {
+        qCritical() << "CoverStore: unable to encode " << thumbnail << ":" << writer.errorString();
+        file.remove();
+        return false;
+    }
+    file.close();
+
+    if (!file.rename(thumbnail))
+    {
+        file.remove();
+        return QFile::exists(thumbnail);
+    }
+    return true;
+}
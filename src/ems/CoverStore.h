@@ -0,0 +1,111 @@
+#ifndef COVERSTORE_H
+#define COVERSTORE_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QThreadPool>
+
+/* Album covers of the cache directory, stored by content:
+ * <cache>/covers/<2 first digits>/<sha1 of the image>.<extension>
+ * An image is written only once, whatever the number of albums (or of
+ * tracks) which use it, and two albums with the same name can't overwrite
+ * the cover of each other. The albums reference the stored path.
+ * The cover of a directory is remembered until the next scan: the tracks
+ * of an album don't look for it and hash it again.
+ * The thumbnails of a new image (main/cover_thumbnail_sizes) are made by a
+ * background thread, the HttpClient only has to send them. The other sizes
+ * are made on request by a small pool (main/thumbnail_workers), out of the
+ * event loop.
+ */
+class CoverStore : public QObject
+{
+    Q_OBJECT
+public:
+    /* Thread safe API */
+
+    /* Cover file already known for a music directory (possibly empty) */
+    bool cachedDirectoryCover(const QString &directory, QString *cover);
+    void setDirectoryCover(const QString &directory, const QString &cover);
+
+    /* Embedded cover already found for an album of a directory without
+     * cover file: a directory can hold several albums.
+     */
+    bool cachedEmbeddedCover(const QString &directory, const QString &album, QString *cover);
+    void setEmbeddedCover(const QString &directory, const QString &album, const QString &cover);
+
+    /* Look for a cover file in a music directory (cover.png, folder.jpg...)
+     * and store it. Return an empty path if the directory has none.
+     */
+    QString findDirectoryCover(const QString &directory);
+
+    /* Store an image, return its path in the cache (empty on error) */
+    QString store(const QByteArray &image, const QString &extension);
+    QString storeFile(const QString &filename);
+
+    /* Forget the covers of the directories, they may have changed */
+    void clearDirectoryCache();
+
+    /* Make the thumbnails of main/cover_thumbnail_sizes in background */
+    void queueThumbnails(const QString &path);
+
+    /* Thumbnail of a stored image, size is a power of two */
+    static QString thumbnailPath(const QString &path, int size);
+    static bool createThumbnail(const QString &path, int size);
+
+    /* Make a thumbnail for a client which waits for it, thumbnailReady()
+     * is emitted by the main thread when it is done.
+     */
+    void requestThumbnail(const QString &path, int size);
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static CoverStore* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new CoverStore;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+signals:
+    /* thumbnail is empty if it can't be made */
+    void thumbnailReady(QString path, int size, QString thumbnail);
+
+private slots:
+    void thumbnailDone(QString path, int size, bool done);
+
+private:
+    QString m_coversDir;
+    QList<int> m_thumbnailSizes;
+    int m_thumbnailQuality;
+    QThreadPool m_thumbnailPool;
+
+    /* Thumbnails requested by the clients, protected by m_mutex */
+    QThreadPool m_requestPool;
+    QSet<QString> m_requestedThumbnails;
+
+    QMutex m_mutex;
+    QHash<QString, QString> m_directoryCovers; /* Stored path (or empty) by directory */
+    QHash<QPair<QString, QString>, QString> m_embeddedCovers; /* Stored path by (directory, album) */
+
+    static CoverStore* _instance;
+    CoverStore();
+    CoverStore(const CoverStore &);
+    CoverStore& operator=(const CoverStore &);
+};
+
+#endif // COVERSTORE_H
@@ -60,6 +60,38 @@ public:
     }
 };
 
+/* Result of stat() on a music file, stored with its filename.
+ * If it has not changed since the last scan, the file is considered as
+ * unchanged and its sha1 is not computed again.
+ */
+class EMSFileStat
+{
+public:
+    unsigned long long size; /* In bytes */
+    long long mtime; /* Last modification, in seconds since epoch */
+    unsigned long long inode;
+    unsigned long long device;
+
+    EMSFileStat()
+    {
+        size = 0;
+        mtime = 0;
+        inode = 0;
+        device = 0;
+    }
+
+    bool operator==(const EMSFileStat &other) const
+    {
+        return size == other.size && mtime == other.mtime &&
+               inode == other.inode && device == other.device;
+    }
+
+    bool operator!=(const EMSFileStat &other) const
+    {
+        return !(*this == other);
+    }
+};
+
 /* Track structure can be used for :
  * TRACK_TYPE_DB : Database entry (all field filled)
  * TRACK_TYPE_EXTERNAL : File located outside the directory managed by EMS (eg. USB stick)
@@ -84,6 +116,9 @@ public:
     /* Used for removing old files which are not in the disk anymore */
     unsigned long long lastscan;
 
+    /* stat() of the file when it was scanned (TRACK_TYPE_DB only) */
+    EMSFileStat fileStat;
+
     EMSAlbum album;
 
     QVector<EMSArtist> artists;
@@ -241,4 +276,23 @@ public:
         track_total = 0;
     }
 };
+
+class EMSScanProgress
+{
+public:
+    QString phase; /* walk, hash, db, cleanup, metadata or idle */
+    unsigned long long files_seen; /* music files found in the locations */
+    unsigned long long files_new; /* files with an unknown sha1 */
+    double files_per_second;
+    double mb_per_second; /* data read to compute the sha1 */
+    qint64 eta; /* in seconds, -1 if unknown */
+    EMSScanProgress()
+    {
+        files_seen = 0;
+        files_new = 0;
+        files_per_second = 0;
+        mb_per_second = 0;
+        eta = -1;
+    }
+};
 #endif // DATA_H
@@ -4,6 +4,7 @@
 #include <QFile>
 #include <QSettings>
 #include <QCoreApplication>
+#include <QDateTime>
 
 Database* Database::_instance = 0;
 
@@ -30,9 +31,11 @@ bool Database::insertNewTrack(EMSTrack *newTrack)
 
     qDebug() << "Inserting new track " << newTrack->name << "in the database...";
 
-    /* Use transaction to get "atomic" behavior in case of failure */
+    /* Use a savepoint to get "atomic" behavior in case of failure.
+     * Unlike BEGIN, it can be nested in a batch transaction (see beginTransaction).
+     */
     QSqlQuery q(db);
-    if (!q.exec("BEGIN;"))
+    if (!q.exec("SAVEPOINT insert_track;"))
     {
         qCritical() << "Failed to begin a transaction : " << q.lastError().text();
         return false;
@@ -44,17 +47,18 @@ bool Database::insertNewTrack(EMSTrack *newTrack)
     {
         qDebug() << "Track SHA1 is already present in database...";
 
-        if(!insertNewFilename(newTrack->filename, trackID, newTrack->lastscan))
+        if(!insertNewFilename(newTrack->filename, trackID, newTrack->lastscan, newTrack->fileStat))
         {
             qCritical() << "Error while inserting new track : " << q.lastError().text();
             qCritical() << "Last query was : " << q.lastQuery();
-            q.exec("ROLLBACK;");
+            q.exec("ROLLBACK TO insert_track;");
+            q.exec("RELEASE insert_track;");
             return false;
         }
 
         /* Track already exists and the new filename has been added */
         newTrack->id = trackID;
-        q.exec("COMMIT;");
+        q.exec("RELEASE insert_track;");
         return true;
     }
     else
@@ -78,7 +82,8 @@ bool Database::insertNewTrack(EMSTrack *newTrack)
         {
             qCritical() << "Error while inserting new track : " << q.lastError().text();
             qCritical() << "Last query was : " << q.lastQuery();
-            q.exec("ROLLBACK;");
+            q.exec("ROLLBACK TO insert_track;");
+            q.exec("RELEASE insert_track;");
             return false;
         }
 
@@ -88,99 +93,186 @@ bool Database::insertNewTrack(EMSTrack *newTrack)
 
         /* Insert new filename */
         qDebug() << "Adding filename " << newTrack->filename << " in the table files...";
-        if(!insertNewFilename(newTrack->filename, newTrack->id, newTrack->lastscan))
+        if(!insertNewFilename(newTrack->filename, newTrack->id, newTrack->lastscan, newTrack->fileStat))
         {
             qCritical() << "Error while inserting new filename for track ID : " << QString("%1").arg(newTrack->id);
-            q.exec("ROLLBACK;");
+            q.exec("ROLLBACK TO insert_track;");
+            q.exec("RELEASE insert_track;");
             return false;
         }
     }
 
+    /* Link the track with its artists and genres */
+    if (!linkArtists(newTrack) || !linkGenres(newTrack))
+    {
+        q.exec("ROLLBACK TO insert_track;");
+        q.exec("RELEASE insert_track;");
+        return false;
+    }
+
+    /* All went well => COMMIT */
+    q.exec("RELEASE insert_track;");
+    return true;
+}
+
+/* Link the track with its artists, the missing artists are created.
+ * The links which already exist are kept.
+ * Must be called inside a savepoint: on failure, the caller rolls back.
+ */
+bool Database::linkArtists(EMSTrack *track)
+{
+    QSqlQuery q(db);
+
     /* Look for the artists in the db (use the "name" as key) */
-    for (int i = 0; i < newTrack->artists.size(); ++i)
+    for (int i = 0; i < track->artists.size(); ++i)
     {
-        qDebug() << "Linking with artist " << newTrack->artists[i].name << "...";
+        qDebug() << "Linking with artist " << track->artists[i].name << "...";
         EMSArtist dbArtist;
 
         /* Look for an existing artist with the same name */
-        if (getArtistByName(&dbArtist, newTrack->artists[i].name))
+        if (getArtistByName(&dbArtist, track->artists[i].name))
         {
             qDebug() << "Artist " << dbArtist.name << " already exists in the database with ID " << QString("%1").arg(dbArtist.id);
-            newTrack->artists[i].id = dbArtist.id;
+            track->artists[i].id = dbArtist.id;
         }
         else /* Artist not found => create it */
         {
-            qDebug() << "Artist " << newTrack->artists[i].name << " does not exist in the database, adding it...";
+            qDebug() << "Artist " << track->artists[i].name << " does not exist in the database, adding it...";
 
             q.prepare("INSERT INTO artists(name, picture) VALUES (?,?);");
-            q.bindValue(0, newTrack->artists[i].name);
-            q.bindValue(1, newTrack->artists[i].picture);
+            q.bindValue(0, track->artists[i].name);
+            q.bindValue(1, track->artists[i].picture);
             if(!q.exec())
             {
                 qCritical() << "Error while inserting new artist : " << q.lastError().text();
-                q.exec("ROLLBACK;");
                 return false;
             }
             /* Retrieve the new id in the database */
-            newTrack->artists[i].id = q.lastInsertId().toULongLong();
-            qDebug() << "New artist ID is " << QString("%1").arg(newTrack->artists[i].id);
+            track->artists[i].id = q.lastInsertId().toULongLong();
+            qDebug() << "New artist ID is " << QString("%1").arg(track->artists[i].id);
         }
 
         /* Link the artist to the new track */
         qDebug() << "Add relation between the track and the artist...";
-        q.prepare("INSERT INTO tracks_artists(track_id, artist_id) VALUES (?,?);");
-        q.bindValue(0, newTrack->id);
-        q.bindValue(1, newTrack->artists[i].id);
+        q.prepare("INSERT OR IGNORE INTO tracks_artists(track_id, artist_id) VALUES (?,?);");
+        q.bindValue(0, track->id);
+        q.bindValue(1, track->artists[i].id);
         if(!q.exec())
         {
             qCritical() << "Error while inserting the relation track-artist : " << q.lastError().text();
         }
     }
 
+    return true;
+}
+
+/* Same as linkArtists for the genres */
+bool Database::linkGenres(EMSTrack *track)
+{
+    QSqlQuery q(db);
+
     /* Look for the genres in the db (use the "name" as key) */
-    for (int i = 0; i < newTrack->genres.size(); ++i)
+    for (int i = 0; i < track->genres.size(); ++i)
     {
-        qDebug() << "Linking with genre " << newTrack->genres[i].name << "...";
+        qDebug() << "Linking with genre " << track->genres[i].name << "...";
         EMSGenre dbGenre;
 
         /* Look for an existing artist with the same name */
-        if (getGenreByName(&dbGenre, newTrack->genres[i].name))
+        if (getGenreByName(&dbGenre, track->genres[i].name))
         {
             qDebug() << "Genre " << dbGenre.name << " already exists in the database with ID " << QString("%1").arg(dbGenre.id);
-            newTrack->genres[i].id = dbGenre.id;
+            track->genres[i].id = dbGenre.id;
         }
         else /* Genre not found => create it */
         {
-            qDebug() << "Genre " << newTrack->genres[i].name << " does not exist in the database, adding it...";
+            qDebug() << "Genre " << track->genres[i].name << " does not exist in the database, adding it...";
 
             q.prepare("INSERT INTO genres(name, picture) VALUES (?,?);");
-            q.bindValue(0, newTrack->genres[i].name);
-            q.bindValue(1, newTrack->genres[i].picture);
+            q.bindValue(0, track->genres[i].name);
+            q.bindValue(1, track->genres[i].picture);
             if(!q.exec())
             {
                 qCritical() << "Error while inserting new genre : " << q.lastError().text();
-                q.exec("ROLLBACK;");
                 return false;
             }
 
             /* Retrieve the new id in the database */
-            newTrack->genres[i].id = q.lastInsertId().toULongLong();
-            qDebug() << "New genre ID is " << QString("%1").arg(newTrack->genres[i].id);
+            track->genres[i].id = q.lastInsertId().toULongLong();
+            qDebug() << "New genre ID is " << QString("%1").arg(track->genres[i].id);
         }
 
         /* Link the genre to the new track */
         qDebug() << "Add relation between the track and the genre...";
-        q.prepare("INSERT INTO tracks_genres(track_id, genre_id) VALUES (?,?);");
-        q.bindValue(0, newTrack->id);
-        q.bindValue(1, newTrack->genres[i].id);
+        q.prepare("INSERT OR IGNORE INTO tracks_genres(track_id, genre_id) VALUES (?,?);");
+        q.bindValue(0, track->id);
+        q.bindValue(1, track->genres[i].id);
         if(!q.exec())
         {
             qCritical() << "Error while inserting the relation track-genre : " << q.lastError().text();
         }
     }
 
-    /* All went well => COMMIT */
-    q.exec("COMMIT;");
+    return true;
+}
+
+/* Update a track inserted before all the plugins were run (see IngestionQueue):
+ * its data, the cover of its album if it had none, and its new artists and genres.
+ */
+bool Database::updateTrack(EMSTrack *track)
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (!q.exec("SAVEPOINT update_track;"))
+    {
+        qCritical() << "Failed to begin a transaction : " << q.lastError().text();
+        return false;
+    }
+
+    q.prepare("UPDATE tracks SET album_id = ?, position = ?, name = ?, sample_rate = ?, "
+              "                  duration = ?, format_parameters = ? "
+              "WHERE id = ?;");
+    q.bindValue(0, track->album.id);
+    q.bindValue(1, track->position);
+    q.bindValue(2, track->name);
+    q.bindValue(3, track->sample_rate);
+    q.bindValue(4, track->duration);
+    q.bindValue(5, track->format_parameters);
+    q.bindValue(6, track->id);
+    if(!q.exec())
+    {
+        qCritical() << "Error while updating track " << track->id << " : " << q.lastError().text();
+        q.exec("ROLLBACK TO update_track;");
+        q.exec("RELEASE update_track;");
+        return false;
+    }
+
+    if (!track->album.cover.isEmpty() && track->album.id != 0)
+    {
+        q.prepare("UPDATE albums SET cover = ? WHERE id = ? AND (cover IS NULL OR cover = '');");
+        q.bindValue(0, track->album.cover);
+        q.bindValue(1, track->album.id);
+        if(!q.exec())
+        {
+            qCritical() << "Error while updating the cover of album " << track->album.id << " : " << q.lastError().text();
+        }
+        else if (q.numRowsAffected() > 0)
+        {
+            albumsGeneration++;
+        }
+    }
+
+    if (!linkArtists(track) || !linkGenres(track))
+    {
+        q.exec("ROLLBACK TO update_track;");
+        q.exec("RELEASE update_track;");
+        return false;
+    }
+
+    q.exec("RELEASE update_track;");
     return true;
 }
 
@@ -208,6 +300,7 @@ bool Database::insertNewAlbum(EMSAlbum *album)
 
     /* Return the new album ID */
     album->id = q.lastInsertId().toULongLong();
+    albumsGeneration++;
 
     return true;
 }
@@ -215,8 +308,10 @@ bool Database::insertNewAlbum(EMSAlbum *album)
 /* Insert a filename (path) for a given already created track
  * The track ID must match an existing row in table tracks
  * If the filename already exist, the track_id is replaced.
+ * fileStat is stored to detect unchanged files during the next scans.
  */
-bool Database::insertNewFilename(QString filename, unsigned long long trackId, unsigned long long timestamp)
+bool Database::insertNewFilename(QString filename, unsigned long long trackId, unsigned long long timestamp,
+                                 const EMSFileStat &fileStat)
 {
     if (!opened)
     {
@@ -225,10 +320,15 @@ bool Database::insertNewFilename(QString filename, unsigned long long trackId, u
 
     /* Get all possible data in one row */
     QSqlQuery q(db);
-    q.prepare("INSERT OR REPLACE INTO files(filename, track_id, timestamp) VALUES (?,?,?);");
+    q.prepare("INSERT OR REPLACE INTO files(filename, track_id, timestamp, size, mtime, inode, device) "
+              "VALUES (?,?,?,?,?,?,?);");
     q.bindValue(0, filename);
     q.bindValue(1, trackId);
     q.bindValue(2, timestamp);
+    q.bindValue(3, fileStat.size);
+    q.bindValue(4, fileStat.mtime);
+    q.bindValue(5, fileStat.inode);
+    q.bindValue(6, fileStat.device);
     if(!q.exec())
     {
         qCritical() << "Inserting filename failed for track ID " << QString("%1").arg(trackId) << " : " << q.lastError().text();
@@ -237,6 +337,97 @@ bool Database::insertNewFilename(QString filename, unsigned long long trackId, u
     return true;
 }
 
+/* Mark an already known file as seen during the scan started at timestamp
+ * (see removeOldFiles). The linked track is not modified.
+ */
+bool Database::updateFilenameTimestamp(QString filename, unsigned long long timestamp)
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("UPDATE files SET timestamp = ? WHERE filename = ?;");
+    q.bindValue(0, timestamp);
+    q.bindValue(1, filename);
+    if(!q.exec())
+    {
+        qCritical() << "Updating timestamp failed for file " << filename << " : " << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* Same as updateFilenameTimestamp for a list of files, with only one prepared query */
+bool Database::updateFilenamesTimestamp(const QStringList &filenames, unsigned long long timestamp)
+{
+    if (!opened)
+    {
+        return false;
+    }
+    if (filenames.isEmpty())
+    {
+        return true;
+    }
+
+    QVariantList timestamps;
+    QVariantList names;
+    foreach (QString filename, filenames)
+    {
+        timestamps << timestamp;
+        names << filename;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("UPDATE files SET timestamp = ? WHERE filename = ?;");
+    q.addBindValue(timestamps);
+    q.addBindValue(names);
+    if(!q.execBatch())
+    {
+        qCritical() << "Updating timestamp of " << filenames.size() << " files failed : " << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* Open a transaction for a batch of insertions. Until commitTransaction is called,
+ * the database lock must be kept, otherwise other modules would write in this
+ * transaction.
+ */
+bool Database::beginTransaction()
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (!q.exec("BEGIN;"))
+    {
+        qCritical() << "Failed to begin a transaction : " << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool Database::commitTransaction()
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (!q.exec("COMMIT;"))
+    {
+        qCritical() << "Failed to commit a transaction : " << q.lastError().text();
+        q.exec("ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
 bool Database::insertNewPlaylist(const QString &playlistName,
                                  unsigned long long *playlistId)
 {
@@ -432,8 +623,11 @@ bool Database::deletePlaylist(unsigned long long playlistId)
  *            is less than the one in database, the record is also deleted as it is not
  *            a regular case.
  * IMPORTANT: a trigger will ensure the corresponding track is deleted is no files references it
+ * If trackIds is given, the tracks of the removed files are added in it (see cleanOrphans).
+ * The files inside the directory are selected with a range on the primary key
+ * ('/' + 1 == '0'): unlike LIKE, it uses the index and is case sensitive.
  */
-void Database::removeOldFiles(QString directory, unsigned long long timestamp)
+void Database::removeOldFiles(QString directory, unsigned long long timestamp, QSet<unsigned long long> *trackIds)
 {
     if (!opened)
     {
@@ -441,9 +635,27 @@ void Database::removeOldFiles(QString directory, unsigned long long timestamp)
     }
 
     QSqlQuery q(db);
-    q.prepare("DELETE FROM files WHERE filename LIKE ? AND timestamp <> ?;");
-    q.bindValue(0, directory+"/%");
-    q.bindValue(1, timestamp);
+    if (trackIds)
+    {
+        q.prepare("SELECT DISTINCT track_id FROM files WHERE filename >= ? AND filename < ? AND timestamp <> ?;");
+        q.bindValue(0, directory+"/");
+        q.bindValue(1, directory+"0");
+        q.bindValue(2, timestamp);
+        if(!q.exec())
+        {
+            qCritical() << "Error when searching old files in " << directory << " : " << q.lastError().text();
+            return;
+        }
+        while (q.next())
+        {
+            trackIds->insert(q.value(0).toULongLong());
+        }
+    }
+
+    q.prepare("DELETE FROM files WHERE filename >= ? AND filename < ? AND timestamp <> ?;");
+    q.bindValue(0, directory+"/");
+    q.bindValue(1, directory+"0");
+    q.bindValue(2, timestamp);
     if(!q.exec())
     {
         qCritical() << "Error when removing old files in " << directory << " : " << q.lastError().text();
@@ -498,6 +710,10 @@ void Database::cleanOrphans()
         qCritical() << "Error when cleaning empty albums";
         qCritical() << "Query was : " << q.lastQuery();
     }
+    else if (q.numRowsAffected() > 0)
+    {
+        albumsGeneration++;
+    }
 
     if (!q.exec(clean_orphanGenre))
     {
@@ -512,6 +728,80 @@ void Database::cleanOrphans()
     }
 }
 
+/* Same as cleanOrphans, but only for the given tracks (the tracks of the files
+ * removed by removeOldFiles) and their albums, artists and genres: the other
+ * rows of the database are not read.
+ */
+void Database::cleanOrphans(const QSet<unsigned long long> &trackIds)
+{
+    if (!opened || trackIds.isEmpty())
+    {
+        return;
+    }
+
+    QStringList ids;
+    foreach (unsigned long long trackId, trackIds)
+    {
+        ids << QString::number(trackId);
+    }
+    QString idList = ids.join(",");
+
+    /* 1) Albums, artists and genres linked to the tracks, before deleting them */
+    QStringList albumIds, artistIds, genreIds;
+    QSqlQuery q(db);
+    if (q.exec("SELECT DISTINCT album_id FROM tracks WHERE id IN (" + idList + ");"))
+    {
+        while (q.next())
+            albumIds << q.value(0).toString();
+    }
+    if (q.exec("SELECT DISTINCT artist_id FROM tracks_artists WHERE track_id IN (" + idList + ");"))
+    {
+        while (q.next())
+            artistIds << q.value(0).toString();
+    }
+    if (q.exec("SELECT DISTINCT genre_id FROM tracks_genres WHERE track_id IN (" + idList + ");"))
+    {
+        while (q.next())
+            genreIds << q.value(0).toString();
+    }
+
+    /* 2) Delete the tracks without file, then the empty albums, artists and genres */
+    if (!q.exec("DELETE FROM tracks WHERE id IN (" + idList + ") AND "
+                "NOT EXISTS (SELECT 1 FROM files WHERE files.track_id = tracks.id);"))
+    {
+        qCritical() << "Error when cleaning orphan tracks";
+        qCritical() << "Query was : " << q.lastQuery();
+    }
+
+    if (!albumIds.isEmpty() &&
+        !q.exec("DELETE FROM albums WHERE id IN (" + albumIds.join(",") + ") AND id <> 0 AND "
+                "NOT EXISTS (SELECT 1 FROM tracks WHERE tracks.album_id = albums.id);"))
+    {
+        qCritical() << "Error when cleaning empty albums";
+        qCritical() << "Query was : " << q.lastQuery();
+    }
+    else if (!albumIds.isEmpty() && q.numRowsAffected() > 0)
+    {
+        albumsGeneration++;
+    }
+
+    if (!artistIds.isEmpty() &&
+        !q.exec("DELETE FROM artists WHERE id IN (" + artistIds.join(",") + ") AND "
+                "NOT EXISTS (SELECT 1 FROM tracks_artists WHERE tracks_artists.artist_id = artists.id);"))
+    {
+        qCritical() << "Error when cleaning orphan artists";
+        qCritical() << "Query was : " << q.lastQuery();
+    }
+
+    if (!genreIds.isEmpty() &&
+        !q.exec("DELETE FROM genres WHERE id IN (" + genreIds.join(",") + ") AND "
+                "NOT EXISTS (SELECT 1 FROM tracks_genres WHERE tracks_genres.genre_id = genres.id);"))
+    {
+        qCritical() << "Error when cleaning orphan genres";
+        qCritical() << "Query was : " << q.lastQuery();
+    }
+}
+
 
 /*****************************************************************************
  *    BROWSE DATABASE
@@ -701,6 +991,224 @@ bool Database::getTrackIdBySha1(unsigned long long *trackID, QString sha1)
     }
 }
 
+/* Look for the trackIDs of several sha1 at once.
+ * Only the sha1 present in the database are inserted in trackIDs.
+ */
+bool Database::getTrackIdsBySha1(QHash<QString, unsigned long long> *trackIDs, const QStringList &sha1List)
+{
+    /* SQLite limits the number of variables in one query (999 by default) */
+    const int maxVariables = 500;
+
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    for (int i=0; i<sha1List.size(); i+=maxVariables)
+    {
+        QStringList sha1Chunk = sha1List.mid(i, maxVariables);
+        QStringList placeholders;
+        for (int j=0; j<sha1Chunk.size(); j++)
+        {
+            placeholders << "?";
+        }
+
+        q.prepare("SELECT tracks.sha1, tracks.id FROM tracks WHERE tracks.sha1 IN (" + placeholders.join(",") + ");");
+        for (int j=0; j<sha1Chunk.size(); j++)
+        {
+            q.bindValue(j, sha1Chunk.at(j));
+        }
+        if(!q.exec())
+        {
+            qCritical() << "Querying track data failed : " << q.lastError().text();
+            return false;
+        }
+        while (q.next())
+        {
+            trackIDs->insert(q.value(0).toString(), q.value(1).toULongLong());
+        }
+    }
+    return true;
+}
+
+/*****************************************************************************
+ *    SCAN CHECKPOINTS
+ ****************************************************************************/
+/* Get the scan which was not finished (EMS stopped during the scan).
+ * Return false if there is none.
+ */
+bool Database::getUnfinishedScan(unsigned long long *scanId, unsigned long long *startTime, QStringList *scope)
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (!q.exec("SELECT id, start_time, scope FROM scans ORDER BY id DESC LIMIT 1;"))
+    {
+        qCritical() << "Querying unfinished scan failed : " << q.lastError().text();
+        return false;
+    }
+    if (!q.next())
+    {
+        return false;
+    }
+
+    *scanId = q.value(0).toULongLong();
+    *startTime = q.value(1).toULongLong();
+    *scope = q.value(2).toString().split("\n", QString::SkipEmptyParts);
+    return true;
+}
+
+/* Insert (scanId is 0) or update a scan in progress */
+bool Database::saveScan(unsigned long long *scanId, unsigned long long startTime, const QStringList &scope)
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (*scanId == 0)
+    {
+        q.prepare("INSERT INTO scans(start_time, scope) VALUES (?,?);");
+        q.bindValue(0, startTime);
+        q.bindValue(1, scope.join("\n"));
+    }
+    else
+    {
+        q.prepare("UPDATE scans SET start_time = ?, scope = ? WHERE id = ?;");
+        q.bindValue(0, startTime);
+        q.bindValue(1, scope.join("\n"));
+        q.bindValue(2, *scanId);
+    }
+    if (!q.exec())
+    {
+        qCritical() << "Saving scan failed : " << q.lastError().text();
+        return false;
+    }
+    if (*scanId == 0)
+    {
+        *scanId = q.lastInsertId().toULongLong();
+    }
+    return true;
+}
+
+/* The scan is complete: forget it and its directories */
+bool Database::removeScan(unsigned long long scanId)
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("DELETE FROM scans WHERE id = ?;");
+    q.bindValue(0, scanId);
+    if (!q.exec())
+    {
+        qCritical() << "Removing scan failed : " << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* Directories whose files are all in the database with the timestamp of the scan */
+void Database::getScanDirectories(unsigned long long scanId, QSet<QString> *directories)
+{
+    if (!opened)
+    {
+        return;
+    }
+
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT directory FROM scans_directories WHERE scan_id = ?;");
+    q.bindValue(0, scanId);
+    if (!q.exec())
+    {
+        qCritical() << "Querying scan directories failed : " << q.lastError().text();
+        return;
+    }
+    while (q.next())
+    {
+        directories->insert(q.value(0).toString());
+    }
+}
+
+bool Database::insertScanDirectories(unsigned long long scanId, const QStringList &directories)
+{
+    if (!opened)
+    {
+        return false;
+    }
+    if (directories.isEmpty())
+    {
+        return true;
+    }
+
+    QVariantList ids;
+    QVariantList names;
+    foreach (QString directory, directories)
+    {
+        ids << scanId;
+        names << directory;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("INSERT OR IGNORE INTO scans_directories(scan_id, directory) VALUES (?,?);");
+    q.addBindValue(ids);
+    q.addBindValue(names);
+    if (!q.execBatch())
+    {
+        qCritical() << "Inserting " << directories.size() << " scan directories failed : " << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* Get the stat() data of all the known files, indexed by filename.
+ * Files inserted without stat data (size = 0) are ignored: they will be hashed again.
+ * If a directory is given, only the files inside it are added to filesStat.
+ */
+void Database::getFilesStat(QHash<QString, EMSFileStat> *filesStat, QString directory)
+{
+    if (!opened)
+    {
+        return;
+    }
+
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (directory.isEmpty())
+    {
+        q.prepare("SELECT filename, size, mtime, inode, device FROM files WHERE size > 0;");
+    }
+    else
+    {
+        q.prepare("SELECT filename, size, mtime, inode, device FROM files "
+                  "WHERE filename >= ? AND filename < ? AND size > 0;");
+        q.bindValue(0, directory+"/");
+        q.bindValue(1, directory+"0");
+    }
+    if(!q.exec())
+    {
+        qCritical() << "Querying files stat failed : " << q.lastError().text();
+        return;
+    }
+    while (q.next())
+    {
+        EMSFileStat fileStat;
+        fileStat.size = q.value(1).toULongLong();
+        fileStat.mtime = q.value(2).toLongLong();
+        fileStat.inode = q.value(3).toULongLong();
+        fileStat.device = q.value(4).toULongLong();
+        filesStat->insert(q.value(0).toString(), fileStat);
+    }
+}
+
 /* Execute the query q which return ONE row
  * Store the result in the track structure
  * Warning: the query MUST match the order of field assignment in this function
@@ -1095,7 +1603,36 @@ void Database::getAlbumsList(QVector<EMSAlbum> *albumsList)
         return;
     }
     QSqlQuery q(db);
-    q.prepare(select_album_data1 + " WHERE albums.id <> 0 ;");
+    q.prepare(select_album_data1 + " WHERE albums.id <> 0 ORDER BY albums.id;");
+    if(!q.exec())
+    {
+        qCritical() << "Querying album data failed : " << q.lastError().text();
+        qDebug() << "Last query was : " << q.lastQuery();
+        return;
+    }
+    albumsList->clear();
+    while (q.next())
+    {
+        // albums.id, albums.name, albums.cover
+        EMSAlbum album;
+        album.id = q.value(0).toULongLong();
+        album.name = q.value(1).toString();
+        album.cover = q.value(2).toString();
+        albumsList->append(album);
+    }
+}
+
+/* Same order as getAlbumsList */
+void Database::getAlbumsPage(QVector<EMSAlbum> *albumsList, qint64 offset, int count)
+{
+    if (!opened)
+    {
+        return;
+    }
+    QSqlQuery q(db);
+    q.prepare(select_album_data1 + " WHERE albums.id <> 0 ORDER BY albums.id LIMIT ? OFFSET ?;");
+    q.bindValue(0, count);
+    q.bindValue(1, offset);
     if(!q.exec())
     {
         qCritical() << "Querying album data failed : " << q.lastError().text();
@@ -1114,6 +1651,24 @@ void Database::getAlbumsList(QVector<EMSAlbum> *albumsList)
     }
 }
 
+/* Number of albums of getAlbumsList */
+qint64 Database::getAlbumsCount()
+{
+    if (!opened)
+    {
+        return 0;
+    }
+    QSqlQuery q(db);
+    q.prepare("SELECT COUNT(*) FROM albums WHERE albums.id <> 0;");
+    if(!q.exec() || !q.next())
+    {
+        qCritical() << "Counting albums failed : " << q.lastError().text();
+        qDebug() << "Last query was : " << q.lastQuery();
+        return 0;
+    }
+    return q.value(0).toLongLong();
+}
+
 void Database::getAlbumsByGenreId(QVector<EMSAlbum> *albumsList, unsigned long long genreId)
 {
     if (!opened)
@@ -1520,6 +2075,11 @@ bool Database::open()
         //TODO_weak : for the future: execute a upgrade script
         //            otherwise, delete the whole database and re-create it
         //if (version < dbVersion)
+        if (!upgradeSchema())
+        {
+            qCritical() << "Database upgrade has failed";
+            return false;
+        }
     }
     else
     {
@@ -1613,9 +2173,64 @@ bool Database::createSchema(QString filePath)
     return true;
 }
 
+/* Add to an existing database the columns which have been added in the
+ * creation script since it has been created.
+ */
+bool Database::upgradeSchema()
+{
+    QStringList filesColumns;
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA table_info(files);"))
+    {
+        qCritical() << "Error while reading the columns of table files : " << q.lastError().text();
+        return false;
+    }
+    while (q.next())
+    {
+        filesColumns << q.value(1).toString();
+    }
+
+    /* stat() data of the files */
+    QStringList statColumns;
+    statColumns << "size" << "mtime" << "inode" << "device";
+    foreach (QString column, statColumns)
+    {
+        if (filesColumns.contains(column))
+        {
+            continue;
+        }
+        qDebug() << "Database: add the column " << column << " in the table files";
+        if (!q.exec(QString("ALTER TABLE files ADD COLUMN `%1` INTEGER NOT NULL DEFAULT 0;").arg(column)))
+        {
+            qCritical() << "Error while adding column " << column << " : " << q.lastError().text();
+            return false;
+        }
+    }
+
+    /* Checkpoints of the scans */
+    if (!q.exec("CREATE TABLE IF NOT EXISTS scans ("
+                "  `id` INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,"
+                "  `start_time` INTEGER NOT NULL,"
+                "  `scope` TEXT);") ||
+        !q.exec("CREATE TABLE IF NOT EXISTS scans_directories ("
+                "  `scan_id` INTEGER NOT NULL,"
+                "  `directory` TEXT NOT NULL,"
+                "  PRIMARY KEY (scan_id, directory),"
+                "  FOREIGN KEY(scan_id) REFERENCES scans(id) ON DELETE CASCADE);"))
+    {
+        qCritical() << "Error while adding the tables of the scans : " << q.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
 Database::Database(QObject *parent) : QObject(parent)
 {
     opened = false;
+
+    /* Not stored: a new start gives a new generation */
+    albumsGeneration = QDateTime::currentMSecsSinceEpoch();
 }
 
 Database::~Database()
@@ -5,6 +5,8 @@
 #include <QVariant>
 #include <QJsonObject>
 #include <QMap>
+#include <QHash>
+#include <QSet>
 #include <QMutex>
 #include <QSqlError>
 #include <QtSql/QSql>
@@ -26,7 +28,15 @@ public:
     /* Interface for track management (server-side actions) */
     bool insertNewAlbum(EMSAlbum *album);
     bool insertNewTrack(EMSTrack *newTrack);
-    bool insertNewFilename(QString filename, unsigned long long trackId, unsigned long long timestamp);
+    bool updateTrack(EMSTrack *track);
+    bool insertNewFilename(QString filename, unsigned long long trackId, unsigned long long timestamp,
+                           const EMSFileStat &fileStat = EMSFileStat());
+    bool updateFilenameTimestamp(QString filename, unsigned long long timestamp);
+    bool updateFilenamesTimestamp(const QStringList &filenames, unsigned long long timestamp);
+
+    /* Group several insertions in one transaction (one commit on the disk) */
+    bool beginTransaction();
+    bool commitTransaction();
 
     /* Interface for playlist management (server-side actions) */
     bool insertNewPlaylist(const QString &playlistName,
@@ -38,8 +48,16 @@ public:
     /* Be careful when removing, you have to clean orphans tracks/albums after
      * Don't release the lock when adding/removing tracks/album
      */
-    void removeOldFiles(QString directory, unsigned long long timestamp);
+    void removeOldFiles(QString directory, unsigned long long timestamp, QSet<unsigned long long> *trackIds = NULL);
     void cleanOrphans();
+    void cleanOrphans(const QSet<unsigned long long> &trackIds);
+
+    /* Checkpoints of the scan in progress (see LocalFileScanner) */
+    bool getUnfinishedScan(unsigned long long *scanId, unsigned long long *startTime, QStringList *scope);
+    bool saveScan(unsigned long long *scanId, unsigned long long startTime, const QStringList &scope);
+    bool removeScan(unsigned long long scanId);
+    void getScanDirectories(unsigned long long scanId, QSet<QString> *directories);
+    bool insertScanDirectories(unsigned long long scanId, const QStringList &directories);
 
     /* Interface for browsing */
     void getTracks(QVector<EMSTrack> *tracksList);
@@ -47,7 +65,13 @@ public:
     void getTracksByPlaylist(QVector<EMSTrack> *tracksList, unsigned long long playlistId);
     bool getTrackById(EMSTrack *track, unsigned long long trackId);
     bool getTrackIdBySha1(unsigned long long *trackID, QString sha1);
+    bool getTrackIdsBySha1(QHash<QString, unsigned long long> *trackIDs, const QStringList &sha1List);
+    void getFilesStat(QHash<QString, EMSFileStat> *filesStat, QString directory = QString());
     void getAlbumsList(QVector<EMSAlbum> *albumsList);
+    void getAlbumsPage(QVector<EMSAlbum> *albumsList, qint64 offset, int count);
+    qint64 getAlbumsCount();
+    /* Changed each time an album is added, removed or gets a cover */
+    unsigned long long getAlbumsGeneration() { return albumsGeneration; }
     void getAlbumsByGenreId(QVector<EMSAlbum> *albumsList, unsigned long long genreId);
     void getAlbumsByArtistId(QVector<EMSAlbum> *albumsList, unsigned long long artistId);
     bool getAlbumById(EMSAlbum *album, unsigned long long albumId);
@@ -111,6 +135,7 @@ private:
     bool opened;
     unsigned int version;
     QSqlDatabase db;
+    unsigned long long albumsGeneration;
 
     /* Data parsed from the QSetting file */
     QString dbSettingPath;
@@ -119,7 +144,10 @@ private:
 
     /* Internal method */
     void configure();
+    bool linkArtists(EMSTrack *track);
+    bool linkGenres(EMSTrack *track);
     bool createSchema(QString filePath);
+    bool upgradeSchema();
     bool storeTrack(QSqlQuery *q, EMSTrack *track);
     void storeTrackList(QSqlQuery *q, QVector<EMSTrack> *tracksList);
     void storeArtistsInTrackList(QSqlQuery *q, QVector<EMSTrack> *tracksList);
@@ -7,6 +7,21 @@
 
 #define EMS_WEBSOCKET_PORT 7337
 #define EMS_HTTP_PORT 7336
+// main/http_keepalive_timeout
+// Time (in ms) after which an idle HTTP connection is closed
+#define EMS_HTTP_KEEPALIVE_TIMEOUT 15000
+// main/http_image_cache_size
+// Memory (in KiB) used to keep the last images served by the HTTP server (0 to disable)
+#define EMS_HTTP_IMAGE_CACHE_SIZE 16384
+// main/http_threads
+// Number of threads serving the HTTP connections
+#define EMS_HTTP_THREADS 2
+// main/http_max_connections
+// Maximum number of HTTP connections served by each thread
+#define EMS_HTTP_MAX_CONNECTIONS 64
+// main/http_stream_bandwidth
+// Maximum throughput (in KiB/s) of each track streamed by the HTTP server (0 for no limit)
+#define EMS_HTTP_STREAM_BANDWIDTH 0
 
 /* DATABASE
  * --------- */
@@ -35,8 +50,71 @@
 #define EMS_MPD_PASSWORD ""
 
 /* Scanner */
+// main/locations
+// Directories of the music library, separated by ','
+#define EMS_LOCATIONS_SEPARATOR ","
 //File extensions used by the scanner to detect new files
 #define EMS_MUSIC_EXTENSIONS "*.flac, *.wav, *.dsf, *.dff, *.mp3, *.ogg"
+// main/scan_workers
+// Number of threads walking the directories and computing the sha1.
+// 0 means one thread per CPU core.
+#define EMS_SCAN_WORKERS 0
+// main/scan_rotational_workers
+// Maximum number of scan workers reading the same spinning disk at the same time
+#define EMS_SCAN_ROTATIONAL_WORKERS 1
+// main/scan_other_workers
+// Same for the other devices (SSD, network file systems, ...). 0: no limit
+#define EMS_SCAN_OTHER_WORKERS 0
+// main/scan_batch_size
+// Number of files/tracks written in the database in one transaction
+#define EMS_SCAN_BATCH_SIZE 500
+// main/scan_batch_period
+// Maximum time (in ms) before writing the buffered files/tracks in the database
+#define EMS_SCAN_BATCH_PERIOD 1000
+// main/scan_batch_retries
+// Number of times a batch which could not be written in the database is tried
+// again (every main/scan_batch_period ms) before being dropped
+#define EMS_SCAN_BATCH_RETRIES 10
+// main/metadata_workers
+// Number of tracks analyzed at the same time by the metadata plugins.
+// 0 means one thread per CPU core.
+#define EMS_METADATA_WORKERS 0
+// main/enrich_workers
+// Number of tracks enriched at the same time by the slow plugins (covers,
+// online lookups, fingerprints), once they are already in the database.
+#define EMS_ENRICH_WORKERS 2
+// main/probe_cache_size
+// Number of files whose first and last blocks are kept in memory between the
+// sha1 lookup and the metadata plugins (0 to disable). At least
+// main/scan_batch_size: one batch gives all its new files at once.
+#define EMS_PROBE_CACHE_SIZE EMS_SCAN_BATCH_SIZE
+// main/probe_queue_depth
+// Number of files read at the same time by each scan worker (1: one after the other),
+// and maximum number of reading threads without io_uring. A deep queue hides the
+// latency of the network file systems. The spinning disks are always read one file
+// after the other.
+#define EMS_PROBE_QUEUE_DEPTH 16
+// main/scan_progress_period
+// Minimum time (in ms) between two EMS_SCAN progress messages
+#define EMS_SCAN_PROGRESS_PERIOD 250
+// main/scan_background
+// Scan with the idle I/O priority and a low CPU priority, without filling the page cache
+#define EMS_SCAN_BACKGROUND true
+// main/scan_play_bandwidth
+// In background mode, maximum read bandwidth (in KiB/s) of the scan while a track is played (0: no limit)
+#define EMS_SCAN_PLAY_BANDWIDTH 2048
+// main/cover_thumbnail_sizes
+// Thumbnails (in pixels, powers of two) made in background for each new cover
+#define EMS_COVER_THUMBNAIL_SIZES "128,256,512"
+// main/thumbnail_workers
+// Number of threads making the other thumbnails requested by the clients
+#define EMS_THUMBNAIL_WORKERS 2
+// main/thumbnail_quality
+// Quality (0-100) of the JPEG thumbnails
+#define EMS_THUMBNAIL_QUALITY 85
+// main/cover_atlas_page_size
+// Number of albums in each cover atlas (sprite sheet) served by /atlas/albums
+#define EMS_COVER_ATLAS_PAGE_SIZE 100
 
 #ifdef Q_OS_MAC
 #define EMS_DIRECTORIES_BASE_PATH "/Volumes"
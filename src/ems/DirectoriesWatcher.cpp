@@ -9,6 +9,7 @@ DirectoriesWatcher::DirectoriesWatcher()
     : QObject()
 {
     m_localFileScanner = new LocalFileScanner();
+    m_fullScanNeeded = true;
     m_fileScannerTrigger = new QTimer(this);
     m_fileScannerTrigger->setSingleShot(true);
 
@@ -72,6 +73,34 @@ void DirectoriesWatcher::start()
     // Launch the first LocalFileScanner run to update the database
     startLocalFileScanner();
 
+#ifdef EMS_INOTIFY_WATCHER
+    // Use the inotify events directly when available: they tell which file
+    // changed, so the modified directories don't need to be listed again
+    if (m_inotifyWatcher.isValid())
+    {
+        connect(&m_inotifyWatcher, &InotifyWatcher::fileCreated,
+                this, &DirectoriesWatcher::handleFileCreated);
+        connect(&m_inotifyWatcher, &InotifyWatcher::fileClosed,
+                this, &DirectoriesWatcher::handleFileChanged);
+        connect(&m_inotifyWatcher, &InotifyWatcher::fileRemoved,
+                this, &DirectoriesWatcher::handleFileChanged);
+        connect(&m_inotifyWatcher, &InotifyWatcher::directoryAdded,
+                this, &DirectoriesWatcher::handleTreeChanged);
+        connect(&m_inotifyWatcher, &InotifyWatcher::directoryRemoved,
+                this, &DirectoriesWatcher::handleTreeChanged);
+        connect(&m_inotifyWatcher, &InotifyWatcher::overflow,
+                this, &DirectoriesWatcher::handleOverflow);
+
+        foreach (QString rootDirectory, m_rootDirectories)
+        {
+            m_inotifyWatcher.addTree(rootDirectory);
+        }
+        qWarning() << "DirectoriesWatcher: nb directories watched with inotify: "
+                   << m_inotifyWatcher.watchedDirectoriesCount();
+        return;
+    }
+#endif
+
     // And now, initialize the directory list to watch.
     // Find all directories and subdirectories
     QVector<QString> allDirectories;
@@ -104,6 +133,7 @@ void DirectoriesWatcher::handleDirectoryChanged(const QString &path)
     m_mutex.lock();
     {
         qDebug() << "DirectoriesWatcher: handle the directory 'changed' signal :" << path;
+        m_dirtyDirectories.insert(path);
 
         // 1- Update the watched directory list
 
@@ -139,19 +169,64 @@ void DirectoriesWatcher::handleDirectoryChanged(const QString &path)
         m_awaited_files_mutex.unlock();
 
         // 2-Update the timer
-        if (m_fileScannerTrigger->isActive())
-        {
-            m_fileScannerTrigger->setInterval(TIME_RESERVE);
-        }
-        else
-        {
-            m_fileScannerTrigger->setInterval(TIME_RESERVE);
-            m_fileScannerTrigger->start();
-        }
+        restartScannerTrigger();
     }
     m_mutex.unlock();
 }
 
+/* A new file is being written: wait until it is closed before scanning */
+void DirectoriesWatcher::handleFileCreated(const QString &filename)
+{
+    m_awaited_files_mutex.lock();
+    m_awaited_files.insert(filename, QFileInfo(filename).size());
+    m_awaited_files_mutex.unlock();
+
+    m_mutex.lock();
+    m_dirtyDirectories.insert(QFileInfo(filename).path());
+    restartScannerTrigger();
+    m_mutex.unlock();
+}
+
+/* A file was written or removed: only its directory has to be scanned again */
+void DirectoriesWatcher::handleFileChanged(const QString &filename)
+{
+    m_awaited_files_mutex.lock();
+    m_awaited_files.remove(filename);
+    m_awaited_files_mutex.unlock();
+
+    m_mutex.lock();
+    m_dirtyDirectories.insert(QFileInfo(filename).path());
+    restartScannerTrigger();
+    m_mutex.unlock();
+}
+
+/* A directory was added or removed: scan it with its subdirectories */
+void DirectoriesWatcher::handleTreeChanged(const QString &path)
+{
+    qDebug() << "DirectoriesWatcher: change in " << path;
+
+    m_mutex.lock();
+    m_dirtyDirectories.insert(path);
+    restartScannerTrigger();
+    m_mutex.unlock();
+}
+
+/* Some events were lost: the modified directories are unknown */
+void DirectoriesWatcher::handleOverflow()
+{
+    m_mutex.lock();
+    m_fullScanNeeded = true;
+    restartScannerTrigger();
+    m_mutex.unlock();
+}
+
+/* Run the LocalFileScanner TIME_RESERVE ms after the last change */
+void DirectoriesWatcher::restartScannerTrigger()
+{
+    m_fileScannerTrigger->setInterval(TIME_RESERVE);
+    m_fileScannerTrigger->start();
+}
+
 void DirectoriesWatcher::printDebugWatchedDirectories()
 {
     // Used to debug only:
@@ -201,6 +276,20 @@ void DirectoriesWatcher::startLocalFileScanner()
             m_localFileScannerWorker.quit();
             m_localFileScannerWorker.wait();
 
+            // Only scan the directories modified since the last run
+            m_mutex.lock();
+            if (m_fullScanNeeded)
+            {
+                m_localFileScanner->setScanScope(QStringList());
+            }
+            else
+            {
+                m_localFileScanner->setScanScope(m_dirtyDirectories.toList());
+            }
+            m_fullScanNeeded = false;
+            m_dirtyDirectories.clear();
+            m_mutex.unlock();
+
             // Start a new one
             qDebug() << "DirectoriesWatcher: start the LocalFileScanner";
             m_localFileScannerWorker.start();
@@ -10,6 +10,10 @@
 #include <QThread>
 #include <QSet>
 
+#ifdef EMS_INOTIFY_WATCHER
+#include "InotifyWatcher.h"
+#endif
+
 class LocalFileScanner;
 
 class DirectoriesWatcher : public QObject
@@ -27,11 +31,18 @@ private:
     void printDebugWatchedDirectories();
     void addDirectoryInWatcher(QString directory);
     bool needToWaitOpenedFile();
+    void restartScannerTrigger();
 
     LocalFileScanner *m_localFileScanner;
     QVector<QString> m_rootDirectories;
     QFileSystemWatcher m_qtWatcher;
+#ifdef EMS_INOTIFY_WATCHER
+    InotifyWatcher m_inotifyWatcher;
+#endif
     QMap<QString, qint64> m_awaited_files;
+    // Directories to scan at the next run of the LocalFileScanner
+    QSet<QString> m_dirtyDirectories;
+    bool m_fullScanNeeded;
     QMutex m_awaited_files_mutex;
 
     // Timer to trigger the start of the localFileScanner
@@ -41,6 +52,10 @@ private:
 
 private slots:
     void handleDirectoryChanged(const QString &path);
+    void handleFileCreated(const QString &filename);
+    void handleFileChanged(const QString &filename);
+    void handleTreeChanged(const QString &path);
+    void handleOverflow();
     void startLocalFileScanner(void);
 };
 
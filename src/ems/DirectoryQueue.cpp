@@ -0,0 +1,225 @@
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef Q_OS_LINUX
+#include <sys/sysmacros.h>
+#endif
+
+#include "DirectoryQueue.h"
+
+DirectoryQueue::DirectoryQueue(int nbWorkers, int rotationalWorkers, int otherWorkers)
+{
+    if (nbWorkers < 1)
+    {
+        nbWorkers = 1;
+    }
+    for (int i=0; i<nbWorkers; i++)
+    {
+        m_deques.append(new Deque);
+    }
+    m_current.fill(0, nbWorkers);
+
+    /* 0 means no other limit than the number of workers */
+    m_rotationalWorkers = (rotationalWorkers > 0) ? rotationalWorkers : nbWorkers;
+    m_otherWorkers = (otherWorkers > 0) ? otherWorkers : nbWorkers;
+
+    m_pending = 0;
+    m_aborted = false;
+}
+
+DirectoryQueue::~DirectoryQueue()
+{
+    qDeleteAll(m_deques);
+}
+
+void DirectoryQueue::push(int workerId, const QString &directory)
+{
+    Entry entry;
+    struct stat st;
+
+    entry.directory = directory;
+    entry.device = (stat(directory.toUtf8().data(), &st) == 0) ? st.st_dev : 0;
+
+    /* Count the directory before it becomes visible to the other workers,
+     * otherwise a thief could finish it and see a null counter.
+     */
+    m_mutex.lock();
+    m_pending++;
+    if (!m_budgets.contains(entry.device))
+    {
+        m_budgets.insert(entry.device, deviceBudget(entry.device));
+    }
+    m_mutex.unlock();
+
+    Deque *deque = m_deques.at(workerId % m_deques.size());
+    deque->mutex.lock();
+    deque->entries.append(entry);
+    deque->mutex.unlock();
+
+    m_mutex.lock();
+    m_workAvailable.wakeOne();
+    m_mutex.unlock();
+}
+
+bool DirectoryQueue::pop(int workerId, QString *directory)
+{
+    Entry entry;
+
+    m_mutex.lock();
+    while (!m_aborted)
+    {
+        if (take(workerId, &entry))
+        {
+            m_active[entry.device]++;
+            m_current[workerId % m_current.size()] = entry.device;
+            m_mutex.unlock();
+            *directory = entry.directory;
+            return true;
+        }
+        if (m_pending == 0)
+        {
+            /* Nothing queued and nobody is listing a directory: end of scan */
+            break;
+        }
+        /* Either nothing is queued, or the devices of the queued directories
+         * are already busy: wait for a push() or a done()
+         */
+        m_workAvailable.wait(&m_mutex);
+    }
+    m_workAvailable.wakeAll();
+    m_mutex.unlock();
+    return false;
+}
+
+void DirectoryQueue::done(int workerId)
+{
+    m_mutex.lock();
+    m_active[m_current.at(workerId % m_current.size())]--;
+    m_pending--;
+    /* A device has a free slot, or this is the end of the scan */
+    m_workAvailable.wakeAll();
+    m_mutex.unlock();
+}
+
+/* The files of a spinning disk are read one after the other: parallel
+ * reads would only make the head seek between them.
+ */
+bool DirectoryQueue::isRotational(int workerId)
+{
+    m_mutex.lock();
+    bool rotational = m_rotationalDevices.contains(m_current.at(workerId % m_current.size()));
+    m_mutex.unlock();
+
+    return rotational;
+}
+
+void DirectoryQueue::abort()
+{
+    m_mutex.lock();
+    m_aborted = true;
+    m_workAvailable.wakeAll();
+    m_mutex.unlock();
+}
+
+bool DirectoryQueue::isAborted()
+{
+    bool aborted;
+    m_mutex.lock();
+    aborted = m_aborted;
+    m_mutex.unlock();
+    return aborted;
+}
+
+/* Must be called with m_mutex locked */
+bool DirectoryQueue::take(int workerId, Entry *entry)
+{
+    int nbDeques = m_deques.size();
+
+    /* Own deque first : newest directory (depth-first) */
+    if (takeFrom(m_deques.at(workerId % nbDeques), true, entry))
+    {
+        return true;
+    }
+
+    /* Then steal the oldest directory of another worker */
+    for (int i=1; i<nbDeques; i++)
+    {
+        if (takeFrom(m_deques.at((workerId + i) % nbDeques), false, entry))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Take the newest (or oldest) entry of a device which can accept one more worker.
+ * Must be called with m_mutex locked.
+ */
+bool DirectoryQueue::takeFrom(Deque *deque, bool newest, Entry *entry)
+{
+    bool found = false;
+
+    deque->mutex.lock();
+    int size = deque->entries.size();
+    for (int i=0; i<size; i++)
+    {
+        int index = newest ? (size - 1 - i) : i;
+        if (isAllowed(deque->entries.at(index).device))
+        {
+            *entry = deque->entries.takeAt(index);
+            found = true;
+            break;
+        }
+    }
+    deque->mutex.unlock();
+
+    return found;
+}
+
+/* Must be called with m_mutex locked */
+bool DirectoryQueue::isAllowed(quint64 device)
+{
+    return m_active.value(device) < m_budgets.value(device, m_otherWorkers);
+}
+
+/* Number of workers allowed on the device. On Linux, a spinning disk is
+ * detected with /sys/dev/block/<major>:<minor>/queue/rotational (in the
+ * parent directory for a partition). Network file systems have no block
+ * device and get the budget of the SSDs.
+ * Must be called with m_mutex locked.
+ */
+int DirectoryQueue::deviceBudget(quint64 device)
+{
+    bool rotational = false;
+
+#ifdef Q_OS_LINUX
+    QString blockPath = QFileInfo(QString("/sys/dev/block/%1:%2").arg(major(device)).arg(minor(device))).canonicalFilePath();
+    if (!blockPath.isEmpty())
+    {
+        QFile queue(blockPath + "/queue/rotational");
+        if (!queue.exists())
+        {
+            queue.setFileName(blockPath + "/../queue/rotational");
+        }
+        if (queue.open(QIODevice::ReadOnly))
+        {
+            rotational = (queue.readAll().trimmed() == "1");
+            queue.close();
+        }
+    }
+#else
+    Q_UNUSED(device);
+#endif
+
+    if (rotational)
+    {
+        m_rotationalDevices.insert(device);
+    }
+    int budget = rotational ? m_rotationalWorkers : m_otherWorkers;
+    qDebug() << "DirectoryQueue: device" << device << (rotational ? "(rotational)" : "")
+             << "scanned by" << budget << "workers at most";
+    return budget;
+}
@@ -0,0 +1,75 @@
+#ifndef DIRECTORYQUEUE_H
+#define DIRECTORYQUEUE_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QQueue>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+/* Work-stealing queue of directories shared by the DirectoryWorker pool.
+ * Each worker owns a deque : it pushes the sub-directories it discovers and
+ * pops from the back (depth-first, good locality on disk). When its own
+ * deque is empty, a worker steals from the front of another worker's deque
+ * (the oldest entries, usually the biggest sub-trees).
+ * The scan is over when no directory is queued and no worker is still
+ * listing a directory (which could push new ones).
+ *
+ * Each directory is tagged with its device (st_dev). The number of workers
+ * listing directories of the same device is limited: rotationalWorkers for
+ * a spinning disk (seeks are expensive), otherWorkers for the others (SSD,
+ * network file systems, ...). A worker only takes a directory of a device
+ * whose budget is not exhausted.
+ */
+class DirectoryQueue
+{
+public:
+    DirectoryQueue(int nbWorkers, int rotationalWorkers, int otherWorkers);
+    ~DirectoryQueue();
+
+    /* Thread safe API */
+    void push(int workerId, const QString &directory);
+    bool pop(int workerId, QString *directory); /* Block until work or end of scan */
+    void done(int workerId); /* The directory returned by pop() has been fully listed */
+    bool isRotational(int workerId); /* The directory returned by pop() is on a spinning disk */
+    void abort();
+    bool isAborted();
+
+    int workersCount() const { return m_deques.size(); }
+
+private:
+    struct Entry
+    {
+        QString directory;
+        quint64 device;
+    };
+
+    struct Deque
+    {
+        QMutex mutex;
+        QQueue<Entry> entries;
+    };
+
+    QVector<Deque*> m_deques;
+    int m_rotationalWorkers;
+    int m_otherWorkers;
+
+    /* Protect the counters below and wake up idle workers */
+    QMutex m_mutex;
+    QWaitCondition m_workAvailable;
+    int m_pending; /* Directories queued or being listed */
+    bool m_aborted;
+    QHash<quint64, int> m_budgets; /* Maximum number of workers, by device */
+    QHash<quint64, int> m_active; /* Workers listing a directory, by device */
+    QVector<quint64> m_current; /* Device of the directory of each worker */
+    QSet<quint64> m_rotationalDevices;
+
+    bool take(int workerId, Entry *entry);
+    bool takeFrom(Deque *deque, bool newest, Entry *entry);
+    bool isAllowed(quint64 device);
+    int deviceBudget(quint64 device);
+};
+
+#endif // DIRECTORYQUEUE_H
@@ -3,14 +3,23 @@
 #include <QThread>
 #include <QDebug>
 #include <QCoreApplication>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "sha1.h"
+#include "FileProbe.h"
+#include "ProbeEngine.h"
+#include "ScanMonitor.h"
+#include "ScanThrottle.h"
 #include "DirectoryWorker.h"
 
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-
-DirectoryWorker::DirectoryWorker(QString path, QString extensions, QObject *parent) :
+DirectoryWorker::DirectoryWorker(DirectoryQueue *queue, int workerId, QString extensions,
+                                 const QHash<QString, EMSFileStat> *knownFiles,
+                                 const QSet<QString> *completedDirectories, QObject *parent) :
     QObject(parent),
-    m_path(path)
+    m_queue(queue),
+    m_workerId(workerId),
+    m_knownFiles(knownFiles),
+    m_completedDirectories(completedDirectories)
 
 {
     m_extensions = extensions.split(",");
@@ -25,75 +34,147 @@ DirectoryWorker::~DirectoryWorker()
 
 void DirectoryWorker::process()
 {
-    QDir rootDir(m_path);
-    scanDir(rootDir);
+    QString directory;
+
+    /* Idle I/O priority in background mode */
+    ScanThrottle::instance()->setThreadPriority();
+    ProbeEngine probeEngine(ScanThrottle::instance()->isBackground());
+
+    /* Work until all the directories of all the locations have been listed */
+    while (m_queue->pop(m_workerId, &directory))
+    {
+        scanDir(QDir(directory), &probeEngine);
+        m_queue->done(m_workerId);
+    }
     emit finished(this);
     QCoreApplication::processEvents();
 }
 
-void DirectoryWorker::scanDir(QDir dir)
+void DirectoryWorker::scanDir(QDir dir, ProbeEngine *probeEngine)
 {
     dir.setNameFilters(m_extensions);
     dir.setFilter(QDir::AllDirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
 
     QFileInfoList fileList = dir.entryInfoList();
+    bool completed = m_completedDirectories && m_completedDirectories->contains(dir.absolutePath());
+    QStringList filesToRead;
+    QVector<EMSFileStat> fileStats;
 
     foreach (const QFileInfo &fi, fileList)
     {
         if (fi.isDir())
         {
-            scanDir(QDir(fi.absoluteFilePath()));
+            /* Let the other workers steal it if they are idle */
+            m_queue->push(m_workerId, fi.absoluteFilePath());
             continue;
         }
 
-        char sha1[20];
+        if (m_queue->isAborted())
+        {
+            return;
+        }
+
+        if (completed)
+        {
+            /* Already in the database with the timestamp of this scan */
+            continue;
+        }
 
         QString fullPath = fi.absoluteFilePath();
-        sha1Compute(fullPath, (unsigned char*)sha1);
+        ScanMonitor::instance()->fileSeen();
+        EMSFileStat fileStat;
+        if (fileStatCompute(fullPath, &fileStat) && m_knownFiles &&
+            m_knownFiles->value(fullPath) == fileStat)
+        {
+            /* Same file as in the last scan: don't read it again */
+            emit fileUnchanged(fullPath);
+            continue;
+        }
+
+        filesToRead << fullPath;
+        fileStats << fileStat;
+    }
+
+    /* The files are read several at a time by the engine, in any order.
+     * Each file is opened only once: the probe goes with the file to the
+     * IngestionQueue, and is kept for the metadata plugins if it is new.
+     */
+    bool keepProbes = FileProbeCache::instance()->isEnabled();
+    probeEngine->probe(filesToRead, m_queue->isRotational(m_workerId),
+                       [&](int index, QSharedPointer<FileProbe> probe) -> bool
+    {
+        char sha1[20];
+
+        if (m_queue->isAborted())
+        {
+            return false;
+        }
+        if (probe.isNull())
+        {
+            /* Unreadable file, no sha1 to compute. A file of the last scan
+             * keeps its track: it would be removed at the end of the scan.
+             */
+            if (m_knownFiles && m_knownFiles->contains(filesToRead.at(index)))
+            {
+                emit fileUnchanged(filesToRead.at(index));
+            }
+            return true;
+        }
+
+        sha1Compute(probe.data(), (unsigned char*)sha1);
+        ScanMonitor::instance()->fileRead(probe->headSize() + probe->tailSize());
+        ScanThrottle::instance()->throttle(probe->headSize() + probe->tailSize());
         QByteArray byteArray = QByteArray::fromRawData(sha1, 20);
         QString sha1StrHex(byteArray.toHex());
-        emit fileFound(fullPath, sha1StrHex);
+        emit fileFound(filesToRead.at(index), sha1StrHex, fileStats.at(index),
+                       keepProbes ? probe : QSharedPointer<FileProbe>());
+        return true;
+    });
+
+    if (m_queue->isAborted())
+    {
+        return;
+    }
+
+    if (!completed)
+    {
+        emit directoryScanned(dir.absolutePath());
+    }
+}
+
+/* Get the data used to know if a file has changed since the last scan */
+bool DirectoryWorker::fileStatCompute(QString filename, EMSFileStat *fileStat)
+{
+    struct stat st;
+
+    if (stat(filename.toUtf8().data(), &st) != 0)
+    {
+        qDebug() << "Error getting status of " << filename;
+        return false;
     }
+
+    fileStat->size = st.st_size;
+    fileStat->mtime = st.st_mtime;
+    fileStat->inode = st.st_ino;
+    fileStat->device = st.st_dev;
+    return true;
 }
 
-/* Create a (unique?) sha1 based on content of the file */
+/* Create a (unique?) sha1 based on content of the file :
+ * the first and the last 64KiB (the whole file twice if it is smaller).
+ */
 bool
-DirectoryWorker::sha1Compute(QString filename, unsigned char *sha1)
+DirectoryWorker::sha1Compute(const FileProbe *probe, unsigned char *sha1)
 {
-    FILE *fd;
-    quint64 fsize;
-    unsigned int rsize = 0;
-    quint8 *tmp;
     SHA1 ctx;
 
-    fd = fopen(filename.toUtf8().data(), "rb");
-    if (!fd)
-      {
-         qDebug() << "Error opening " << filename;
-         return false;
-      }
-
     if (!sha1)
       return false;
 
     sha1_init(&ctx);
-
-    fseek(fd, 0, SEEK_END);
-    fsize = ftell(fd);
-    fseek(fd, 0, SEEK_SET);
-
-    rsize = MIN(65536, fsize);
-    tmp = (quint8*)calloc(rsize, sizeof(uint8_t));
-
-    fread(tmp, 1, rsize, fd);
-    sha1_update(&ctx, tmp, rsize);
-    fseek(fd, (long)(fsize - 65536), SEEK_SET);
-    fread(tmp, 1, rsize, fd);
-    sha1_update(&ctx, tmp, rsize);
+    sha1_update(&ctx, probe->head(), probe->headSize());
+    sha1_update(&ctx, probe->tail(), probe->tailSize());
     sha1_final(&ctx, sha1);
 
-    free(tmp);
-    fclose(fd);
-
     return true;
 }
@@ -3,23 +3,46 @@
 
 #include <QObject>
 #include <QDir>
+#include <QHash>
+#include <QSet>
 
+#include "Data.h"
+#include "DirectoryQueue.h"
+#include "FileProbe.h"
+#include "ProbeEngine.h"
+
+/* One worker of the scanner pool. It takes directories from the shared
+ * DirectoryQueue, queues the sub-directories it finds and computes the
+ * sha1 of each music file. The files of a directory are read together by
+ * the ProbeEngine of the worker.
+ * Files whose stat() data match the ones of knownFiles are not read.
+ * The files of the completedDirectories (already done by the interrupted
+ * scan which is resumed) are skipped, only their sub-directories are queued.
+ */
 class DirectoryWorker : public QObject
 {
     Q_OBJECT
 public:
-    explicit DirectoryWorker(QString path, QString extensions, QObject *parent = nullptr);
+    explicit DirectoryWorker(DirectoryQueue *queue, int workerId, QString extensions,
+                             const QHash<QString, EMSFileStat> *knownFiles,
+                             const QSet<QString> *completedDirectories, QObject *parent = nullptr);
     ~DirectoryWorker();
 
 private:
-    QString m_path;
+    DirectoryQueue *m_queue;
+    int m_workerId;
     QStringList m_extensions;
-    void scanDir(QDir dir);
-    bool sha1Compute(QString filename, unsigned char *sha1);
+    const QHash<QString, EMSFileStat> *m_knownFiles; /* Read only, shared by all workers */
+    const QSet<QString> *m_completedDirectories; /* Read only, shared by all workers */
+    void scanDir(QDir dir, ProbeEngine *probeEngine);
+    bool sha1Compute(const FileProbe *probe, unsigned char *sha1);
+    bool fileStatCompute(QString filename, EMSFileStat *fileStat);
 
 signals:
     void finished(DirectoryWorker* me);
-    void fileFound(QString, QString);
+    void fileFound(QString, QString, EMSFileStat, QSharedPointer<FileProbe>);
+    void fileUnchanged(QString);
+    void directoryScanned(QString);
 
 public slots:
     void process();
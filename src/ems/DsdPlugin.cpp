@@ -6,6 +6,9 @@ DsdPlugin::DsdPlugin()
 {
     capabilities << "dsf";
     capabilities << "dff";
+
+    /* Only reads the DSF/DSDIFF headers of the track */
+    reentrant = true;
 }
 
 DsdPlugin::~DsdPlugin()
@@ -86,6 +89,11 @@ bool DsdPlugin::getDsfMetadata(EMSTrack *track)
     }
     file.close();
 
+    return parseDsfChunks(track, header, format);
+}
+
+bool DsdPlugin::parseDsfChunks(EMSTrack *track, const DsfHeader &header, const DsfFmtChunk &format)
+{
     if (!format.id.Equals("fmt "))
     {
         /* Not a valid DSF file, skip it */
@@ -223,3 +231,30 @@ bool DsdPlugin::update(EMSTrack *track)
     return true;
 }
 
+/* The DSF header and format chunk are at the beginning of the file:
+ * read them from the blocks of the probe. DSDIFF files are parsed chunk
+ * by chunk, so they are still read from the file.
+ */
+bool DsdPlugin::update(EMSTrack *track, const FileProbe *probe)
+{
+    if (track->format != "dsf" || !probe ||
+        probe->headSize() < (qint64)(sizeof(DsfHeader) + sizeof(DsfFmtChunk)))
+    {
+        return update(track);
+    }
+
+    DsfHeader header;
+    DsfFmtChunk format;
+    memcpy(&header, probe->head(), sizeof(header));
+    memcpy(&format, probe->head() + sizeof(header), sizeof(format));
+
+    if (!header.id.Equals("DSD "))
+    {
+        /* Not a DSF file, skip it */
+        qDebug() << "The file " << track->filename << " is not in the DSF format";
+        return false;
+    }
+
+    return parseDsfChunks(track, header, format);
+}
+
@@ -4,6 +4,9 @@
 #include "MetadataPlugin.h"
 #include "Data.h"
 
+struct DsfHeader;
+struct DsfFmtChunk;
+
 /* The DSF plugin read metadata from in files
  * in DSD format. Most of code in this plugin
  * is initially copied from MPD source code.
@@ -20,9 +23,11 @@ public:
     ~DsdPlugin();
 
     bool update(EMSTrack *track);
+    bool update(EMSTrack *track, const FileProbe *probe);
 
 private:
     bool getDsfMetadata(EMSTrack *track);
+    bool parseDsfChunks(EMSTrack *track, const DsfHeader &header, const DsfFmtChunk &format);
     bool getDsdiffMetadata(EMSTrack *track);
 };
 
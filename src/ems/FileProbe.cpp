@@ -0,0 +1,214 @@
+#include <QDebug>
+#include <QSettings>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "DefaultSettings.h"
+#include "FileProbe.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+const qint64 FileProbe::blockSize;
+
+/* A network file system may read less than asked: read the rest */
+static bool readBlock(int fd, char *buffer, qint64 length, qint64 offset)
+{
+    while (length > 0)
+    {
+        ssize_t ret = pread(fd, buffer, length, offset);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        buffer += ret;
+        length -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+FileProbe::FileProbe() :
+    m_fileSize(0),
+    m_head(NULL),
+    m_headSize(0),
+    m_tail(NULL),
+    m_tailSize(0)
+{
+
+}
+
+FileProbe::~FileProbe()
+{
+    release();
+}
+
+void FileProbe::release()
+{
+    m_headBuffer.clear();
+    m_tailBuffer.clear();
+    m_head = NULL;
+    m_tail = NULL;
+    m_headSize = 0;
+    m_tailSize = 0;
+    m_fileSize = 0;
+}
+
+bool FileProbe::open(const QString &filename, bool dropCache)
+{
+    struct stat st;
+    int fd;
+
+    release();
+    m_filename = filename;
+
+    fd = ::open(filename.toUtf8().data(), O_RDONLY);
+    if (fd < 0)
+    {
+        qDebug() << "Error opening " << filename;
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        qDebug() << "Error getting status of " << filename;
+        ::close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+#ifdef Q_OS_LINUX
+    if (dropCache)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    /* The blocks are copied, not mapped: a mapping kept until the metadata
+     * plugins run would raise SIGBUS if the file is truncated meanwhile, or
+     * on an I/O error of the page. A read just fails.
+     */
+    allocateBuffers(filename, st.st_size);
+    qint64 tailOffset = m_fileSize - m_tailSize;
+    if (!readBlock(fd, m_headBuffer.data(), m_headSize, 0) ||
+        (!m_tailBuffer.isEmpty() &&
+         !readBlock(fd, m_tailBuffer.data(), m_tailSize, tailOffset)))
+    {
+        qDebug() << "Error reading " << filename;
+        ::close(fd);
+        release();
+        return false;
+    }
+    attachBuffers();
+
+#ifdef Q_OS_LINUX
+    if (dropCache)
+    {
+        /* The blocks are copied: free their pages, they would evict the file being played */
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#else
+    Q_UNUSED(dropCache);
+#endif
+
+    ::close(fd);
+    return true;
+}
+
+/* Size the buffers for the blocks of the file.
+ * A small file has only one block : the tail buffer is not used.
+ */
+void FileProbe::allocateBuffers(const QString &filename, unsigned long long fileSize)
+{
+    release();
+    m_filename = filename;
+    m_fileSize = fileSize;
+    m_headSize = MIN(blockSize, (qint64)m_fileSize);
+    m_tailSize = m_headSize;
+
+    m_headBuffer.resize(m_headSize);
+    if ((qint64)m_fileSize > blockSize)
+    {
+        m_tailBuffer.resize(m_tailSize);
+    }
+}
+
+/* The buffers have been read */
+void FileProbe::attachBuffers()
+{
+    if ((qint64)m_fileSize <= blockSize)
+    {
+        m_tailBuffer = m_headBuffer;
+    }
+    m_head = (const unsigned char *)m_headBuffer.constData();
+    m_tail = (const unsigned char *)m_tailBuffer.constData();
+}
+
+/* ---------------------------------------------------------
+ *                  PROBES CACHE
+ * --------------------------------------------------------- */
+
+FileProbeCache* FileProbeCache::_instance = 0;
+
+FileProbeCache::FileProbeCache()
+{
+    QSettings settings;
+    int batchSize;
+    EMS_LOAD_SETTINGS(m_maxProbes, "main/probe_cache_size",
+                      EMS_PROBE_CACHE_SIZE, Int);
+    EMS_LOAD_SETTINGS(batchSize, "main/scan_batch_size",
+                      EMS_SCAN_BATCH_SIZE, Int);
+
+    /* The new files of a batch must not push each other out */
+    if (m_maxProbes > 0 && m_maxProbes < batchSize)
+    {
+        m_maxProbes = batchSize;
+    }
+}
+
+void FileProbeCache::insert(QSharedPointer<FileProbe> probe)
+{
+    if (m_maxProbes <= 0)
+    {
+        return;
+    }
+
+    m_mutex.lock();
+    if (!m_probes.contains(probe->filename()))
+    {
+        m_order.enqueue(probe->filename());
+    }
+    m_probes.insert(probe->filename(), probe);
+
+    /* Drop the oldest probes */
+    while (m_order.size() > m_maxProbes)
+    {
+        m_probes.remove(m_order.dequeue());
+    }
+    m_mutex.unlock();
+}
+
+QSharedPointer<FileProbe> FileProbeCache::take(const QString &filename)
+{
+    QSharedPointer<FileProbe> probe;
+
+    m_mutex.lock();
+    probe = m_probes.take(filename);
+    if (probe)
+    {
+        m_order.removeOne(filename);
+    }
+    m_mutex.unlock();
+
+    return probe;
+}
@@ -0,0 +1,109 @@
+#ifndef FILEPROBE_H
+#define FILEPROBE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QQueue>
+#include <QMutex>
+#include <QSharedPointer>
+
+/* Head and tail blocks of a music file, read with only one open().
+ * The blocks are copied in buffers (a small file is read only once), the
+ * file descriptor is closed as soon as they are available.
+ * The same probe is used to compute the sha1 of the file and then given to
+ * the metadata plugins, which can parse the headers from memory instead of
+ * opening the file again.
+ */
+class FileProbe
+{
+public:
+    static const qint64 blockSize = 65536;
+
+    FileProbe();
+    ~FileProbe();
+
+    /* If dropCache is true, the file is removed from the page cache
+     * once read (background scan).
+     */
+    bool open(const QString &filename, bool dropCache = false);
+
+    QString filename() const { return m_filename; }
+    unsigned long long fileSize() const { return m_fileSize; }
+
+    /* First min(blockSize, fileSize) bytes of the file */
+    const unsigned char *head() const { return m_head; }
+    qint64 headSize() const { return m_headSize; }
+
+    /* Last min(blockSize, fileSize) bytes of the file */
+    const unsigned char *tail() const { return m_tail; }
+    qint64 tailSize() const { return m_tailSize; }
+
+private:
+    QString m_filename;
+    unsigned long long m_fileSize;
+
+    const unsigned char *m_head;
+    qint64 m_headSize;
+    const unsigned char *m_tail;
+    qint64 m_tailSize;
+
+    QByteArray m_headBuffer;
+    QByteArray m_tailBuffer;
+
+    void release();
+
+    /* The ProbeEngine reads the blocks in the buffers itself, as open() */
+    friend class ProbeEngine;
+    void allocateBuffers(const QString &filename, unsigned long long fileSize);
+    void attachBuffers();
+
+    FileProbe(const FileProbe &);
+    FileProbe& operator=(const FileProbe &);
+};
+
+/* Keep the probes of the new files (unknown sha1) until the MetadataManager
+ * needs them. They are inserted by the IngestionQueue, once the sha1 lookup
+ * of their batch is done. The number of probes is limited
+ * (main/probe_cache_size, at least main/scan_batch_size): the oldest ones
+ * are dropped and their file will simply be opened again.
+ */
+class FileProbeCache
+{
+public:
+    /* Thread safe API */
+    bool isEnabled() const { return m_maxProbes > 0; }
+    void insert(QSharedPointer<FileProbe> probe);
+    QSharedPointer<FileProbe> take(const QString &filename);
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static FileProbeCache* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new FileProbeCache;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+private:
+    QMutex m_mutex;
+    QHash<QString, QSharedPointer<FileProbe> > m_probes;
+    QQueue<QString> m_order; /* Oldest first */
+    int m_maxProbes;
+
+    static FileProbeCache* _instance;
+    FileProbeCache();
+    FileProbeCache(const FileProbeCache &);
+    FileProbeCache& operator=(const FileProbeCache &);
+};
+
+#endif // FILEPROBE_H
@@ -4,6 +4,9 @@
 FlacPlugin::FlacPlugin()
 {
     capabilities << "flac";
+
+    /* libFLAC only works on the file of the given track */
+    reentrant = true;
 }
 
 FlacPlugin::~FlacPlugin()
@@ -74,10 +77,75 @@ bool FlacPlugin::getStreamInfo(EMSTrack *track)
     return false;
 }
 
+/* Parse one "NAME=value" vorbis comment */
+void FlacPlugin::parseComment(EMSTrack *track, const char *str)
+{
+    char *tmp_s = strdup(str);
+    char *tmp = tmp_s;
+    while (*tmp)
+    {
+        if ((*tmp >= 'a' ) && (*tmp <= 'z'))
+            *tmp -= ('a'-'A');
+        tmp++;
+    }
+
+    if (!strncmp(tmp_s, "TITLE=", 6))
+    {
+        if (track->name.isEmpty())
+        {
+            track->name = str + 6;
+        }
+    }
+    else if (!strncmp(tmp_s, "ARTIST=", 7))
+    {
+        addArtist(track, str+7);
+    }
+    else if (!strncmp(tmp_s, "COMPOSER=", 9))
+    {
+        //addArtist(track, str+9);
+        //Not stored for now. We will add compositor name in the database later
+    }
+    else if (!strncmp(tmp_s, "ORCHESTRA=", 10))
+    {
+        addArtist(track, str+10);
+    }
+    else if (!strncmp(tmp_s, "ALBUM=", 6))
+    {
+        if (track->album.name.isEmpty())
+        {
+            EMSAlbum album;
+            album.name = str + 6;
+            track->album = album;
+        }
+    }
+    else if (!strncmp(tmp_s, "GENRE=", 6))
+    {
+        addGenre(track, str+6);
+    }
+    else if (!strncmp(tmp_s, "TRACKNUMBER=", 12))
+    {
+        int track_nb = atoi(str + 12);
+        if (track_nb >= 0)
+        {
+            track->position = track_nb;
+        }
+    }
+    else if (!strncmp(tmp_s, "DATE=", 5))
+    {
+        //int date = atoi(str + 5);
+        //Not stored.
+    }
+    else if (!strncmp(tmp_s, "COMMENT=", 8))
+    {
+        //Not stored.
+    }
+
+    free(tmp_s);
+}
+
 bool FlacPlugin::update(EMSTrack *track)
 {
     FLAC__StreamMetadata *tags = 0;
-    char *str;
 
     /* Retrieve length, rate and other format data. */
     if(!getStreamInfo(track))
@@ -92,68 +160,149 @@ bool FlacPlugin::update(EMSTrack *track)
 
     for (unsigned int i = 0; i < tags->data.vorbis_comment.num_comments; i++)
     {
+        parseComment(track, (char *) tags->data.vorbis_comment.comments[i].entry);
+    }
 
-        str = (char *) tags->data.vorbis_comment.comments[i].entry;
-        char *tmp_s = strdup(str);
-        char *tmp = tmp_s;
-        while (*tmp)
-        {
-            if ((*tmp >= 'a' ) && (*tmp <= 'z'))
-                *tmp -= ('a'-'A');
-            tmp++;
-        }
+    FLAC__metadata_object_delete(tags);
+    return true;
+}
 
-        if (!strncmp(tmp_s, "TITLE=", 6))
-        {
-            if (track->name.isEmpty())
-            {
-                track->name = str + 6;
-            }
-        }
-        else if (!strncmp(tmp_s, "ARTIST=", 7))
-        {
-            addArtist(track, str+7);
-        }
-        else if (!strncmp(tmp_s, "COMPOSER=", 9))
+/* Use the blocks already read by the scanner if all the metadata blocks
+ * we need are inside the head of the file. Otherwise use libFLAC.
+ */
+bool FlacPlugin::update(EMSTrack *track, const FileProbe *probe)
+{
+    bool hasTags = false;
+
+    if (probe && parseHead(track, probe, &hasTags))
+    {
+        return hasTags;
+    }
+    return update(track);
+}
+
+static inline quint32 readUint32LE(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((quint32)p[3] << 24);
+}
+
+/* Parse the STREAMINFO and VORBIS_COMMENT metadata blocks from memory.
+ * See https://xiph.org/flac/format.html
+ * Return false if these blocks are not entirely in the head of the file.
+ */
+bool FlacPlugin::parseHead(EMSTrack *track, const FileProbe *probe, bool *hasTags)
+{
+    const unsigned char *data = probe->head();
+    qint64 size = probe->headSize();
+    qint64 pos = 4;
+    qint64 streamInfoPos = -1;
+    qint64 commentPos = -1;
+    qint64 commentLength = 0;
+
+    if (size < 4 || memcmp(data, "fLaC", 4))
+    {
+        /* Maybe an ID3 tag before the FLAC stream: let libFLAC handle it */
+        return false;
+    }
+
+    /* 1) Locate the metadata blocks */
+    bool last = false;
+    while (!last)
+    {
+        if (pos + 4 > size)
         {
-            //addArtist(track, str+9);
-            //Not stored for now. We will add compositor name in the database later
+            return false;
         }
-        else if (!strncmp(tmp_s, "ORCHESTRA=", 10))
+        last = data[pos] & 0x80;
+        unsigned int type = data[pos] & 0x7f;
+        qint64 length = (data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3];
+        pos += 4;
+
+        if (type == FLAC__METADATA_TYPE_STREAMINFO)
         {
-            addArtist(track, str+10);
+            streamInfoPos = pos;
         }
-        else if (!strncmp(tmp_s, "ALBUM=", 6))
+        else if (type == FLAC__METADATA_TYPE_VORBIS_COMMENT)
         {
-            if (track->album.name.isEmpty())
+            commentPos = pos;
+            commentLength = length;
+            if (commentPos + commentLength > size)
             {
-                EMSAlbum album;
-                album.name = str + 6;
-                track->album = album;
+                return false;
             }
-        }
-        else if (!strncmp(tmp_s, "GENRE=", 6))
-        {
-            addGenre(track, str+6);
-        }
-        else if (!strncmp(tmp_s, "TRACKNUMBER=", 12))
-        {
-            int track_nb = atoi(str + 12);
-            if (track_nb >= 0)
+            /* Do not look further: remaining blocks (pictures, ...) can be huge */
+            if (streamInfoPos >= 0)
             {
-                track->position = track_nb;
+                break;
             }
         }
-        else if (!strncmp(tmp_s, "DATE=", 5))
+        pos += length;
+    }
+
+    if (streamInfoPos < 0 || streamInfoPos + FLAC__STREAM_METADATA_STREAMINFO_LENGTH > size)
+    {
+        return false;
+    }
+
+    /* 2) STREAMINFO: sample rate (20 bits), channels (3), bits per sample (5), total samples (36) */
+    const unsigned char *si = data + streamInfoPos;
+    unsigned int sampleRate = (si[10] << 12) | (si[11] << 4) | (si[12] >> 4);
+    unsigned int channels = ((si[12] >> 1) & 0x07) + 1;
+    unsigned int bitsPerSample = (((si[12] & 0x01) << 4) | (si[13] >> 4)) + 1;
+    quint64 totalSamples = ((quint64)(si[13] & 0x0f) << 32) | ((quint64)si[14] << 24) |
+                           (si[15] << 16) | (si[16] << 8) | si[17];
+    if (sampleRate == 0)
+    {
+        return false;
+    }
+
+    track->sample_rate = sampleRate;
+    track->duration = totalSamples / sampleRate;
+    track->format_parameters.clear();
+    track->format_parameters.append(QString("channels:%1;").arg(channels));
+    track->format_parameters.append(QString("bits_per_sample:%1;").arg(bitsPerSample));
+
+    /* 3) VORBIS_COMMENT: little endian lengths, vendor string then the comments */
+    *hasTags = false;
+    if (commentPos < 0)
+    {
+        return true;
+    }
+
+    const unsigned char *vc = data + commentPos;
+    const unsigned char *vcEnd = vc + commentLength;
+    if (vc + 4 > vcEnd)
+    {
+        return true;
+    }
+    quint32 vendorLength = readUint32LE(vc);
+    vc += 4;
+    if (vendorLength > (quint32)(vcEnd - vc) || vcEnd - vc - vendorLength < 4)
+    {
+        return true;
+    }
+    vc += vendorLength;
+    quint32 nbComments = readUint32LE(vc);
+    vc += 4;
+
+    for (quint32 i = 0; i < nbComments; i++)
+    {
+        if (vcEnd - vc < 4)
         {
-            //int date = atoi(str + 5);
-            //Not stored.
+            break;
         }
-        else if (!strncmp(tmp_s, "COMMENT=", 8))
+        quint32 length = readUint32LE(vc);
+        vc += 4;
+        if (length > (quint32)(vcEnd - vc))
         {
-            //Not stored.
+            break;
         }
+        /* Comments are not null-terminated */
+        QByteArray comment((const char *)vc, length);
+        parseComment(track, comment.constData());
+        vc += length;
     }
+    *hasTags = true;
 
     return true;
 }
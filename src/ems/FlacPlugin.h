@@ -13,11 +13,14 @@ public:
     ~FlacPlugin();
 
     bool update(EMSTrack *track);
+    bool update(EMSTrack *track, const FileProbe *probe);
 
 private:
     void addArtist(EMSTrack *track, const char *str);
     void addGenre(EMSTrack *track, const char *str);
     bool getStreamInfo(EMSTrack *track);
+    void parseComment(EMSTrack *track, const char *str);
+    bool parseHead(EMSTrack *track, const FileProbe *probe, bool *hasTags);
 };
 
 #endif // FLACPLUGIN_H
@@ -5,6 +5,7 @@
 #include "GracenotePlugin.h"
 #include "CdromManager.h"
 #include "Database.h"
+#include "CoverStore.h"
 
 #define CLIENT_APP_VERSION "1.0.0.0"
 #define EMS_GRACENOTE_USER_HANDLE_FILE "user.txt"
@@ -763,6 +764,10 @@ bool GracenotePlugin::albumGdoToEMSTrack(gnsdk_gdo_handle_t albumGdo, EMSTrack *
         gnsdk_link_query_set_gdo(queryHandle, albumGdo);
         downloadImage(queryHandle, gnsdk_link_content_cover_art, albumsCacheDir, gnid,&coverPath);
         track->album.cover = coverPath;
+        if (!coverPath.isEmpty())
+        {
+            CoverStore::instance()->queueThumbnails(coverPath);
+        }
         gnsdk_link_query_release(queryHandle);
     }
 
@@ -1,6 +1,16 @@
 #include <QFile>
-#include <QImage>
+#include <QLocale>
+#include <QUrlQuery>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "HttpClient.h"
+#include "CoverStore.h"
+#include "ImageCache.h"
+#include "TrackStream.h"
+#include "TranscodeStream.h"
+#include "CoverAtlas.h"
 #include "CdromManager.h"
 #include "Data.h"
 #include "Database.h"
@@ -17,6 +27,7 @@ int onMessageBeginCb(http_parser *parser)
     client->m_hasValue = false;
     client->m_hField.clear();
     client->m_hValue.clear();
+    client->m_requestHeaders.clear();
     return 0;
 }
 
@@ -99,14 +110,30 @@ int onMessageCompleteCb(http_parser *parser)
     client->m_parsingDone = true;
     client->m_requestMethod = parser->method;
 
+    /* Pipelining: the requests are answered in their order of arrival */
+    HttpRequest request;
+    request.url = client->m_parseUrl;
+    request.method = parser->method;
+    request.headers = client->m_requestHeaders;
+    request.keepAlive = http_should_keep_alive(parser);
+    request.http11 = parser->http_major > 1 || (parser->http_major == 1 && parser->http_minor >= 1);
+    client->m_requests.enqueue(request);
+
     return 0;
 }
 
 
-HttpClient::HttpClient(QTcpSocket *socket, QString cacheDirectory, QObject *parent) :
+HttpClient::HttpClient(QTcpSocket *socket, QString cacheDirectory, int keepAliveTimeout,
+                       int streamBandwidth, QObject *parent) :
     QObject(parent),
     m_cacheDirectory(cacheDirectory),
-    m_socket(socket)
+    m_socket(socket),
+    m_pendingSize(0),
+    m_pendingAtlasGeneration(0),
+    m_pendingAtlasPage(0),
+    m_pendingAtlasSize(0),
+    m_stream(NULL),
+    m_streamBandwidth(streamBandwidth)
 {
 
 
@@ -124,134 +151,792 @@ HttpClient::HttpClient(QTcpSocket *socket, QString cacheDirectory, QObject *pare
     m_httpParserSettings->on_body = onBodyCb;
     m_httpParserSettings->on_message_complete = onMessageCompleteCb;
 
+    /* Idle persistent connection */
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(keepAliveTimeout);
+    connect(&m_idleTimer, &QTimer::timeout, this, &HttpClient::CloseConnection);
+    m_idleTimer.start();
+
     connect(socket, &QTcpSocket::readyRead, [=]{
-        parseRequest();
+        if (!parseRequest())
+        {
+            return;
+        }
+        processRequests();
+    });
+    connect(socket, &QTcpSocket::disconnected, this, &QObject::deleteLater);
+}
 
-        //parser need more data, wait for it
-        if (!m_parsingDone)
+/* Answer the queued requests, until one of them has to wait for a thumbnail
+ * or an atlas, or is a track being streamed
+ */
+void HttpClient::processRequests()
+{
+    m_idleTimer.stop();
+    while (!m_requests.isEmpty() && !responsePending())
+    {
+        HttpRequest request = m_requests.dequeue();
+        if (!handleRequest(request))
+        {
+            /* The response is completed by thumbnailReady(), atlasReady() or streamFinished() */
+            m_pendingRequest = request;
+            return;
+        }
+        if (!request.keepAlive)
+        {
+            m_socket->flush();
+            CloseConnection();
             return;
+        }
+    }
+    m_socket->flush();
+    if (!responsePending())
+    {
+        m_idleTimer.start();
+    }
+}
 
-        QString url(m_parseUrl);
-        QStringList arg = url.split('/');
-        QString localFilePath;
+bool HttpClient::responsePending()
+{
+    return !m_pendingImage.isEmpty() || m_pendingAtlasSize > 0 || m_stream;
+}
 
-        if (arg.size() > 1)
+/* Return false if the response is not sent yet */
+bool HttpClient::handleRequest(HttpRequest &request)
+{
+    QString url(request.url);
+    QStringList arg = url.split('/');
+    QString localFilePath;
+
+    if (url.startsWith("/track/"))
+    {
+        return streamTrack(url.mid(7), request);
+    }
+    if (url.section('?', 0, 0) == "/atlas/albums")
+    {
+        return sendAtlas(QUrlQuery(url.section('?', 1)), request);
+    }
+
+    if (arg.size() > 1)
+    {
+        for (int i=1; i<arg.size(); i++)
+        {
+            if (i != 1)
+            {
+                localFilePath += QDir::separator();
+            }
+            localFilePath += arg[i];
+        }
+    }
+    if (localFilePath.isEmpty())
+    {
+        qDebug() << "Bad url : " << url;
+        sendError(HTTP_400, HTTP_400_BODY, request);
+    }
+    else
+    {
+        int resize = -1;
+        if(localFilePath.contains('?'))
         {
-            for (int i=1; i<arg.size(); i++)
+            QStringList parameters = localFilePath.split('?');
+            localFilePath = parameters.first();
+            for (int i=1; i<parameters.size(); i++)
             {
-                if (i != 1)
+                QString parameter = parameters.at(i);
+                if (parameter.startsWith("resize="))
                 {
-                    localFilePath += QDir::separator();
+                    parameter.remove("resize=");
+                    resize = parameter.toInt();
                 }
-                localFilePath += arg[i];
             }
         }
-        if (localFilePath.isEmpty())
+
+        /* Check the file is inside the cache directory */
+        QString cacheDirectory = QDir::cleanPath(m_cacheDirectory);
+        localFilePath = QDir::cleanPath(cacheDirectory + "/" + localFilePath);
+        if (!localFilePath.startsWith(cacheDirectory + "/"))
         {
-            qDebug() << "Bad url : " << url;
+            qCritical() << "Don't serve path " << localFilePath << " as it is not in the cache.";
+            sendError(HTTP_404, HTTP_404_BODY, request);
+            return true;
         }
-        else
+
+        QString extension = QFileInfo(localFilePath).suffix().toLower();
+        QString servedPath = localFilePath;
+        if (resize > 0)
         {
-            int resize = -1;
-            if(localFilePath.contains('?'))
+            /* In order not to have one image per size in the cache, we choose the
+             * closest power of two (supperior)
+             */
+            for (int i=2; i<=2048; i*=2)
             {
-                QStringList parameters = localFilePath.split('?');
-                localFilePath = parameters.first();
-                for (int i=1; i<parameters.size(); i++)
+                if (resize < i || i == 2048)
                 {
-                    QString parameter = parameters.at(i);
-                    if (parameter.startsWith("resize="))
-                    {
-                        parameter.remove("resize=");
-                        resize = parameter.toInt();
-                    }
+                    resize = i;
+                    break;
                 }
             }
+            servedPath = CoverStore::thumbnailPath(localFilePath, resize);
+        }
 
-            localFilePath = m_cacheDirectory + QDir::separator() + localFilePath;
+        /* Hot images are sent from memory, without any access to the storage */
+        ImageCacheEntry entry;
+        if (ImageCache::instance()->find(servedPath, &entry))
+        {
+            sendImage(entry, request);
+            return true;
+        }
 
-            /* Check the file is inside the cache directory */
-            QDir dir;
-            dir.cd(QFileInfo(localFilePath).dir().path());
-            QString pwd = dir.path();
-            if (!pwd.startsWith(m_cacheDirectory))
-            {
-                qCritical() << "Don't serve path " << pwd << " as it is not in the cache.";
-            } else if (QFileInfo(localFilePath).isDir() || !QFileInfo(localFilePath).exists())
+        if (QFileInfo(localFilePath).isDir() || !QFileInfo(localFilePath).exists())
+        {
+            qCritical() << "Don't serve file " << localFilePath << " as it is not an existing file.";
+            sendError(HTTP_404, HTTP_404_BODY, request);
+        }
+        else if (resize > 0 && !QFile::exists(servedPath))
+        {
+            /* Not made in background (yet): don't block the event loop,
+             * the response is sent when the thumbnail is ready
+             */
+            qDebug() << "Resize image to " << QString("%1 pixels").arg(resize);
+            m_pendingImage = localFilePath;
+            m_pendingSize = resize;
+            connect(CoverStore::instance(), &CoverStore::thumbnailReady,
+                    this, &HttpClient::thumbnailReady);
+            CoverStore::instance()->requestThumbnail(localFilePath, resize);
+            return false;
+        }
+        else
+        {
+            sendImage(servedPath, extension, request);
+        }
+    }
+    return true;
+}
+
+HttpClient::~HttpClient()
+{
+    m_socket->deleteLater();
+}
+
+void HttpClient::sendImage(const QString &path, const QString &extension, const HttpRequest &request)
+{
+    ImageCacheEntry entry;
+    if (!loadImage(path, extension, &entry))
+    {
+        sendError(HTTP_404, HTTP_404_BODY, request);
+        return;
+    }
+    ImageCache::instance()->insert(path, entry);
+    sendImage(entry, request);
+}
+
+/* The images are sent with validators: a client which already has the
+ * image gets a 304 without body. The covers of the CoverStore are named
+ * after their content, they never change.
+ */
+bool HttpClient::loadImage(const QString &path, const QString &extension, ImageCacheEntry *entry)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        qCritical() << "Image '" << path << "' does not exist.";
+        return false;
+    }
+    QByteArray body = f.readAll();
+    f.close();
+
+    QFileInfo fi(path);
+    entry->mtime = fi.lastModified().toMSecsSinceEpoch();
+    entry->fileSize = fi.size();
+    entry->etag = QString("\"%1-%2\"").arg(entry->mtime, 0, 16).arg(entry->fileSize, 0, 16);
+    entry->lastModified = fi.lastModified().toUTC();
+    entry->lastModified = entry->lastModified.addMSecs(-entry->lastModified.time().msec());
+    entry->immutable = path.startsWith(QDir::cleanPath(m_cacheDirectory) + "/covers/") ||
+                       path.startsWith(QDir::cleanPath(m_cacheDirectory) + "/atlas/");
+
+    entry->headers.clear();
+    entry->headers += "Content-Type: image/" + extension.toLatin1() + "\r\n";
+    entry->headers += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    entry->headers += "ETag: " + entry->etag.toLatin1() + "\r\n";
+    entry->headers += "Last-Modified: " + httpDate(entry->lastModified).toLatin1() + "\r\n";
+    if (entry->immutable)
+    {
+        entry->headers += "Cache-Control: public, max-age=31536000, immutable\r\n";
+    }
+    else
+    {
+        entry->headers += "Cache-Control: public, max-age=3600\r\n";
+    }
+
+    entry->response = QByteArray(HTTP_200) + "\r\n" + entry->headers + "Connection: keep-alive\r\n\r\n";
+    entry->bodyOffset = entry->response.size();
+    entry->response += body;
+
+    return true;
+}
+
+void HttpClient::sendImage(const ImageCacheEntry &entry, const HttpRequest &request)
+{
+    bool notModified = false;
+    if (request.headers.contains("if-none-match"))
+    {
+        foreach (QString tag, request.headers.value("if-none-match").split(','))
+        {
+            tag = tag.trimmed();
+            if (tag.startsWith("W/"))
             {
-                qCritical() << "Don't serve file " << localFilePath << " as it is not an existing file.";
+                tag.remove(0, 2);
             }
-            else
+            if (tag == entry.etag || tag == "*")
             {
-                QFile f(localFilePath);
-                if (f.open(QIODevice::ReadOnly))
-                {
-                    QString extension = QFileInfo(localFilePath).suffix().toLower();
-                    QHash<QString, QString> headers;
-                    QByteArray body;
-
-                    headers["Connection"] = "Close";
-                    headers["Content-Type"] = "image/" + extension;
-
-                    if (resize > 0)
-                    {
-                        /* In order not to have one image per size in the cache, we choose the
-                         * closest power of two (supperior)
-                         */
-                        for (int i=2; i<=2048; i*=2)
-                        {
-                            if (resize < i || i == 2048)
-                            {
-                                resize = i;
-                                break;
-                            }
-                        }
-
-                        f.close();
-                        f.setFileName(localFilePath+QString("_resized_%1px").arg(resize));
-                        if (!f.exists())
-                        {
-                            qDebug() << "Resize image to " << QString("%1 pixels").arg(resize);
-                            f.open(QIODevice::ReadWrite);
-                            QImage img(localFilePath);
-                            img = img.scaled(resize,resize,Qt::KeepAspectRatioByExpanding,Qt::SmoothTransformation);
-                            img.save(&f, extension.toStdString().c_str(), 100);
-                            f.seek(0);
-                        }
-                        else
-                        {
-                            f.open(QIODevice::ReadOnly);
-                        }
-                        body = f.readAll();
-                        f.close();
-                    }
-                    else
-                    {
-                        body = f.readAll();
-                    }
-
-                    int written = m_socket->write(buildHttpResponse(HTTP_200, headers, body));
-                    if (written == -1)
-                    {
-                        qCritical() << "HttpClient: writing error";
-                    }
-                    f.close();
-                }
-                else
-                {
-                    qCritical() << "Image '" << localFilePath << "' does not exist.";
-                }
+                notModified = true;
             }
         }
-        socket->flush();
+    }
+    else
+    {
+        QDateTime ifModifiedSince = parseHttpDate(request.headers.value("if-modified-since"));
+        notModified = ifModifiedSince.isValid() && entry.lastModified <= ifModifiedSince;
+    }
+
+    QByteArray connection = request.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    if (notModified)
+    {
+        writeResponse(QByteArray(HTTP_304) + "\r\n" + entry.headers + connection);
+    }
+    else if (request.method == HTTP_HEAD)
+    {
+        /* Same headers (Content-Length included), without the image */
+        writeResponse(QByteArray(HTTP_200) + "\r\n" + entry.headers + connection);
+    }
+    else if (request.keepAlive)
+    {
+        /* Built once, sent as is */
+        writeResponse(entry.response);
+    }
+    else
+    {
+        writeResponse(QByteArray(HTTP_200) + "\r\n" + entry.headers + connection + entry.body());
+    }
+}
+
+/* Send the file of a track of the database (path is "<id>?<parameters>").
+ * Return false if the body is being streamed: the next requests are
+ * answered by streamFinished().
+ */
+bool HttpClient::streamTrack(const QString &path, HttpRequest &request)
+{
+    QString trackId = path.section('?', 0, 0);
+    QUrlQuery query(path.section('?', 1));
+    EMSTrack track;
+    bool found = false;
+    bool ok;
+    unsigned long long id = trackId.toULongLong(&ok);
+    if (ok)
+    {
+        Database *db = Database::instance();
+        db->lock();
+        found = db->getTrackById(&track, id);
+        db->unlock();
+    }
+    if (!found || track.type != TRACK_TYPE_DB || track.filename.isEmpty())
+    {
+        qDebug() << "HttpClient: unknown track " << trackId;
+        sendError(HTTP_404, HTTP_404_BODY, request);
+        return true;
+    }
+
+    if (query.hasQueryItem("format") || query.hasQueryItem("max_rate") || query.hasQueryItem("bits"))
+    {
+        bool transcoded;
+        bool sent = transcodeTrack(track, query, request, &transcoded);
+        if (transcoded)
+        {
+            return sent;
+        }
+    }
+
+    struct stat st;
+    int fd = ::open(track.filename.toUtf8().data(), O_RDONLY);
+    if (fd < 0)
+    {
+        qCritical() << "HttpClient: can't open " << track.filename;
+        sendError(HTTP_404, HTTP_404_BODY, request);
+        return true;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        qCritical() << "HttpClient: " << track.filename << " is not a regular file";
+        ::close(fd);
+        sendError(HTTP_404, HTTP_404_BODY, request);
+        return true;
+    }
+
+    qint64 fileSize = st.st_size;
+    QDateTime lastModified = QDateTime::fromTime_t(st.st_mtime).toUTC();
+    QString etag = QString("\"%1-%2\"").arg((qint64)st.st_mtime * 1000, 0, 16).arg(fileSize, 0, 16);
+
+    /* A range of an older version of the file would be corrupted */
+    qint64 offset = 0;
+    qint64 length = fileSize;
+    bool partial = false;
+    QString ifRange = request.headers.value("if-range").trimmed();
+    if (request.headers.contains("range") &&
+        (ifRange.isEmpty() || ifRange == etag || parseHttpDate(ifRange) == lastModified))
+    {
+        partial = parseRange(request.headers.value("range"), fileSize, &offset, &length);
+    }
+
+    QByteArray connection = request.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    if (partial && length == 0)
+    {
+        QByteArray body(HTTP_416_BODY);
+        ::close(fd);
+        writeResponse(QByteArray(HTTP_416) + "\r\n" +
+                      "Content-Type: text/html\r\n" +
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n" +
+                      "Content-Range: bytes */" + QByteArray::number(fileSize) + "\r\n" +
+                      connection + (request.method == HTTP_HEAD ? QByteArray() : body));
+        return true;
+    }
+
+    QByteArray headers = QByteArray(partial ? HTTP_206 : HTTP_200) + "\r\n";
+    headers += "Content-Type: " + audioMimeType(QFileInfo(track.filename).suffix().toLower()).toLatin1() + "\r\n";
+    headers += "Content-Length: " + QByteArray::number(length) + "\r\n";
+    if (partial)
+    {
+        headers += "Content-Range: bytes " + QByteArray::number(offset) + "-" +
+                   QByteArray::number(offset + length - 1) + "/" + QByteArray::number(fileSize) + "\r\n";
+    }
+    headers += "Accept-Ranges: bytes\r\n";
+    headers += "ETag: " + etag.toLatin1() + "\r\n";
+    headers += "Last-Modified: " + httpDate(lastModified).toLatin1() + "\r\n";
+    headers += connection;
+    writeResponse(headers);
+
+    if (request.method == HTTP_HEAD || length == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+#ifdef Q_OS_LINUX
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    TrackStream *stream = new TrackStream(m_socket, fd, offset, length, m_streamBandwidth, this);
+    connect(stream, &TrackStream::finished, this, &HttpClient::streamFinished);
+    m_stream = stream;
+    m_socket->flush();
+
+    /* Started by the event loop: the stream can finish at once */
+    QMetaObject::invokeMethod(m_stream, "start", Qt::QueuedConnection);
+    return false;
+}
+
+/* Send the track in FLAC, at most at max_rate Hz and with at most bits bits.
+ * *transcoded is false if the file already fits: the caller sends it as is.
+ * Return false if the body is being streamed.
+ */
+bool HttpClient::transcodeTrack(const EMSTrack &track, const QUrlQuery &query, HttpRequest &request, bool *transcoded)
+{
+    QString format = query.queryItemValue("format").toLower();
+    int maxRate = query.queryItemValue("max_rate").toInt();
+    int bits = query.queryItemValue("bits").toInt();
+
+    *transcoded = true;
+    if (!format.isEmpty() && format != "flac")
+    {
+        qDebug() << "HttpClient: unsupported format " << format;
+        sendError(HTTP_415, HTTP_415_BODY, request);
+        return true;
+    }
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE *sndFile = sf_open(track.filename.toUtf8().data(), SFM_READ, &info);
+    if (!sndFile)
+    {
+        /* DSD files, for instance */
+        qDebug() << "HttpClient: can't decode " << track.filename << " (" << sf_strerror(NULL) << ")";
+        sendError(HTTP_415, HTTP_415_BODY, request);
+        return true;
+    }
+
+    int outRate = info.samplerate;
+    if (maxRate > 0 && outRate > maxRate)
+    {
+        outRate = outputRate(info.samplerate, maxRate);
+    }
+
+    /* Bits allowed by the FLAC subset. A lossy file has no bits to remove. */
+    int inBits = TranscodeStream::sourceBits(info);
+    int outBits = inBits;
+    bool fewerBits = false;
+    if (bits > 0 && TranscodeStream::isLossless(info))
+    {
+        outBits = qMin(inBits, qBound(8, bits - bits % 4, 24));
+        fewerBits = (outBits < inBits);
+    }
+
+    /* The original file already fits the limits: any re-encoding would
+     * only make it bigger (an MP3 in FLAC, for instance)
+     */
+    bool isFlac = (info.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_FLAC;
+    if (outRate == info.samplerate && !fewerBits && (format.isEmpty() || isFlac))
+    {
+        sf_close(sndFile);
+        *transcoded = false;
+        return true;
+    }
+    if (info.channels < 1 || info.channels > 8)
+    {
+        qDebug() << "HttpClient: can't encode " << info.channels << " channels in FLAC";
+        sf_close(sndFile);
+        sendError(HTTP_415, HTTP_415_BODY, request);
+        return true;
+    }
+
+    TranscodeStream *stream = new TranscodeStream(m_socket, sndFile, info, outRate, outBits, request.http11, this);
+    if (!stream->initialize())
+    {
+        delete stream;
+        sendError(HTTP_500, HTTP_500_BODY, request);
+        return true;
+    }
+    qDebug() << "HttpClient: transcode " << track.filename << " to" << outRate << "Hz," << outBits << "bits";
+
+    /* Without chunks, the end of the body is the end of the connection */
+    if (!request.http11)
+    {
+        request.keepAlive = false;
+    }
+
+    QByteArray headers = QByteArray(HTTP_200) + "\r\n";
+    headers += "Content-Type: audio/flac\r\n";
+    if (request.http11)
+    {
+        headers += "Transfer-Encoding: chunked\r\n";
+    }
+    headers += "Accept-Ranges: none\r\n";
+    headers += request.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    writeResponse(headers);
+
+    if (request.method == HTTP_HEAD)
+    {
+        delete stream;
+        return true;
+    }
+
+    connect(stream, &TranscodeStream::finished, this, &HttpClient::streamFinished);
+    m_stream = stream;
+    QMetaObject::invokeMethod(m_stream, "start", Qt::QueuedConnection);
+    return false;
+}
+
+/* Send the map of an atlas of album covers, made first if needed.
+ * Return false if the client has to wait for atlasReady().
+ */
+bool HttpClient::sendAtlas(const QUrlQuery &query, const HttpRequest &request)
+{
+    int page = qMax(0, query.queryItemValue("page").toInt());
+    int size = query.queryItemValue("size").toInt();
+
+    /* Powers of two, as the thumbnails: the atlas can be made from them */
+    int atlasSize = 32;
+    while (atlasSize < size && atlasSize < 256)
+    {
+        atlasSize *= 2;
+    }
+
+    /* Each page makes files in the cache: only the ones with albums exist.
+     * The first page always exists, possibly empty.
+     */
+    Database *db = Database::instance();
+    db->lock();
+    unsigned long long generation = db->getAlbumsGeneration();
+    qint64 pageSize = CoverAtlas::instance()->pageSize();
+    qint64 nbPages = (db->getAlbumsCount() + pageSize - 1) / pageSize;
+    db->unlock();
+    if (page > 0 && page >= nbPages)
+    {
+        sendError(HTTP_404, HTTP_404_BODY, request);
+        return true;
+    }
+
+    QString path = CoverAtlas::instance()->atlasPath(generation, page, atlasSize);
+    if (QFile::exists(path + ".json"))
+    {
+        sendAtlasMap(path + ".json", request);
+        return true;
+    }
+
+    m_pendingAtlasGeneration = generation;
+    m_pendingAtlasPage = page;
+    m_pendingAtlasSize = atlasSize;
+    connect(CoverAtlas::instance(), &CoverAtlas::atlasReady,
+            this, &HttpClient::atlasReady);
+    CoverAtlas::instance()->requestAtlas(generation, page, atlasSize);
+    return false;
+}
+
+void HttpClient::sendAtlasMap(const QString &path, const HttpRequest &request)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        qCritical() << "HttpClient: atlas map '" << path << "' does not exist.";
+        sendError(HTTP_500, HTTP_500_BODY, request);
+        return;
+    }
+    QByteArray body = f.readAll();
+    f.close();
+
+    /* The map of a page changes with the albums, the image does not */
+    QHash<QString, QString> headers;
+    headers["Connection"] = request.keepAlive ? "keep-alive" : "close";
+    headers["Content-Type"] = "application/json";
+    headers["Cache-Control"] = "no-cache";
+    headers["Content-Length"] = QString::number(body.size());
+    if (request.method == HTTP_HEAD)
+    {
+        body.clear();
+    }
+    writeResponse(buildHttpResponse(HTTP_200, headers, body));
+}
+
+/* An atlas has been made by the CoverAtlas, maybe for another client */
+void HttpClient::atlasReady(unsigned long long generation, int page, int size, QString map)
+{
+    if (generation != m_pendingAtlasGeneration || page != m_pendingAtlasPage || size != m_pendingAtlasSize)
+    {
+        return;
+    }
+    disconnect(CoverAtlas::instance(), &CoverAtlas::atlasReady,
+               this, &HttpClient::atlasReady);
+    m_pendingAtlasSize = 0;
+
+    if (!map.isEmpty())
+    {
+        sendAtlasMap(map, m_pendingRequest);
+    }
+    else
+    {
+        sendError(HTTP_500, HTTP_500_BODY, m_pendingRequest);
+    }
+    if (!m_pendingRequest.keepAlive)
+    {
+        m_socket->flush();
+        CloseConnection();
+        return;
+    }
+
+    /* Next pipelined requests */
+    processRequests();
+}
+
+/* Largest standard rate up to maxRate. A rate of the family of the source
+ * (44.1 or 48 kHz) is preferred, it is an integer ratio with a short filter,
+ * unless it loses more than 10% of the bandwidth: 96 kHz becomes 44.1 kHz
+ * rather than 32 kHz.
+ */
+int HttpClient::outputRate(int sourceRate, int maxRate)
+{
+    static const int standardRates[] = { 384000, 352800, 192000, 176400, 96000, 88200,
+                                         48000, 44100, 32000, 22050, 16000, 11025, 8000 };
+    int familyRate = 0;
+    int bestRate = 0;
+
+    for (unsigned int i=0; i<sizeof(standardRates)/sizeof(standardRates[0]); i++)
+    {
+        int rate = standardRates[i];
+        if (rate > maxRate || rate > sourceRate)
+        {
+            continue;
+        }
+        if (bestRate == 0)
+        {
+            bestRate = rate;
+        }
+        if (familyRate == 0 && sourceRate % rate == 0)
+        {
+            familyRate = rate;
+        }
+    }
+
+    if (bestRate == 0)
+    {
+        /* Below the standard rates */
+        return maxRate;
+    }
+    if (familyRate > 0 && familyRate * 11 >= bestRate * 10)
+    {
+        return familyRate;
+    }
+    return bestRate;
+}
+
+/* Parse a single range of bytes (RFC 7233): "bytes=first-last", "bytes=first-"
+ * or "bytes=-suffixLength".
+ * Return false if the header is ignored (malformed, or several ranges): the
+ * whole file is sent. *length is 0 if the range is not satisfiable.
+ */
+bool HttpClient::parseRange(const QString &range, qint64 fileSize, qint64 *offset, qint64 *length)
+{
+    QString value = range.trimmed();
+    if (!value.startsWith("bytes=") || value.contains(','))
+    {
+        return false;
+    }
+    value.remove(0, 6);
+
+    int dash = value.indexOf('-');
+    if (dash < 0)
+    {
+        return false;
+    }
+    QString first = value.left(dash).trimmed();
+    QString last = value.mid(dash + 1).trimmed();
+    bool ok = true;
+
+    if (first.isEmpty())
+    {
+        /* The last bytes of the file */
+        qint64 suffix = last.toLongLong(&ok);
+        if (!ok || suffix < 0)
+        {
+            return false;
+        }
+        *length = qMin(suffix, fileSize);
+        *offset = fileSize - *length;
+        return true;
+    }
+
+    qint64 start = first.toLongLong(&ok);
+    if (!ok || start < 0)
+    {
+        return false;
+    }
+    qint64 end = fileSize - 1;
+    if (!last.isEmpty())
+    {
+        end = last.toLongLong(&ok);
+        if (!ok || end < start)
+        {
+            return false;
+        }
+        end = qMin(end, fileSize - 1);
+    }
+
+    *offset = start;
+    *length = (start < fileSize) ? end - start + 1 : 0;
+    return true;
+}
+
+QString HttpClient::audioMimeType(const QString &extension)
+{
+    if (extension == "flac")
+        return "audio/flac";
+    if (extension == "mp3")
+        return "audio/mpeg";
+    if (extension == "ogg" || extension == "oga")
+        return "audio/ogg";
+    if (extension == "opus")
+        return "audio/opus";
+    if (extension == "m4a" || extension == "mp4" || extension == "aac")
+        return "audio/mp4";
+    if (extension == "wav")
+        return "audio/wav";
+    if (extension == "aif" || extension == "aiff")
+        return "audio/aiff";
+    return "application/octet-stream";
+}
+
+/* The body of a track has been sent, or the stream failed */
+void HttpClient::streamFinished(bool success)
+{
+    m_stream->deleteLater();
+    m_stream = NULL;
+
+    /* After an error, the length of the response is wrong: close */
+    if (!success || !m_pendingRequest.keepAlive)
+    {
+        m_socket->flush();
         CloseConnection();
+        return;
+    }
 
-    });
+    /* Next pipelined requests */
+    processRequests();
 }
 
-HttpClient::~HttpClient()
+void HttpClient::sendError(QString code, const char *html, const HttpRequest &request)
 {
-    m_socket->deleteLater();
+    QHash<QString, QString> headers;
+    QByteArray body(html);
+
+    headers["Connection"] = request.keepAlive ? "keep-alive" : "close";
+    headers["Content-Type"] = "text/html";
+    headers["Content-Length"] = QString::number(body.size());
+    if (request.method == HTTP_HEAD)
+    {
+        /* A body would be read as the start of the next response */
+        body.clear();
+    }
+    writeResponse(buildHttpResponse(code, headers, body));
+}
+
+void HttpClient::writeResponse(const QByteArray &response)
+{
+    int written = m_socket->write(response);
+    if (written == -1)
+    {
+        qCritical() << "HttpClient: writing error";
+    }
+}
+
+/* A thumbnail has been made by the CoverStore, maybe for another client */
+void HttpClient::thumbnailReady(QString path, int size, QString thumbnail)
+{
+    if (path != m_pendingImage || size != m_pendingSize)
+    {
+        return;
+    }
+    disconnect(CoverStore::instance(), &CoverStore::thumbnailReady,
+               this, &HttpClient::thumbnailReady);
+    m_pendingImage.clear();
+
+    /* Better the original image than nothing */
+    sendImage(thumbnail.isEmpty() ? path : thumbnail, QFileInfo(path).suffix().toLower(), m_pendingRequest);
+    if (!m_pendingRequest.keepAlive)
+    {
+        m_socket->flush();
+        CloseConnection();
+        return;
+    }
+
+    /* Next pipelined requests */
+    processRequests();
+}
+
+/* RFC 7231 date: Sun, 06 Nov 1994 08:49:37 GMT */
+QString HttpClient::httpDate(const QDateTime &date)
+{
+    return QLocale::c().toString(date.toUTC(), "ddd, dd MMM yyyy hh:mm:ss") + " GMT";
+}
+
+QDateTime HttpClient::parseHttpDate(const QString &date)
+{
+    QString value = date.trimmed();
+    if (!value.endsWith(" GMT"))
+    {
+        return QDateTime();
+    }
+    value.chop(4);
+
+    QDateTime parsed = QLocale::c().toDateTime(value, "ddd, dd MMM yyyy hh:mm:ss");
+    parsed.setTimeSpec(Qt::UTC);
+    return parsed;
 }
 
 void HttpClient::CloseConnection()
@@ -260,7 +945,8 @@ void HttpClient::CloseConnection()
     deleteLater();
 }
 
-void HttpClient::parseRequest()
+/* Return false if the request is malformed: the connection is closed */
+bool HttpClient::parseRequest()
 {
     while (m_socket->bytesAvailable())
     {
@@ -269,9 +955,19 @@ void HttpClient::parseRequest()
         if (n != data.size())
         {
             // Errro close connection
+            qDebug() << "HttpClient: bad request (" << http_errno_name(HTTP_PARSER_ERRNO(m_httpParser)) << ")";
+            HttpRequest request;
+            request.method = HTTP_GET;
+            request.keepAlive = false;
+            request.http11 = false;
+            m_requests.clear();
+            sendError(HTTP_400, HTTP_400_BODY, request);
+            m_socket->flush();
             CloseConnection();
+            return false;
         }
     }
+    return true;
 }
 
 QByteArray HttpClient::buildHttpResponse(QString code, QHash<QString,QString> &headers, QByteArray &body)
@@ -3,14 +3,26 @@
 
 #include <QObject>
 #include <QTcpSocket>
+#include <QTimer>
+#include <QQueue>
+#include <QHash>
+#include <QDateTime>
 
 #include "external/http-parser/http_parser.h"
 
-#define HTTP_400 "HTTP/1.0 400 Bad Request"
-#define HTTP_404 "HTTP/1.0 404 Not Found"
+class ImageCacheEntry;
+class QUrlQuery;
+class EMSTrack;
+
+#define HTTP_400 "HTTP/1.1 400 Bad Request"
+#define HTTP_404 "HTTP/1.1 404 Not Found"
 #define HTTP_301 "HTTP/1.1 301 Moved Permanently"
-#define HTTP_500 "HTTP/1.0 500 Internal Server Error"
-#define HTTP_200 "HTTP/1.0 200 OK"
+#define HTTP_304 "HTTP/1.1 304 Not Modified"
+#define HTTP_500 "HTTP/1.1 500 Internal Server Error"
+#define HTTP_200 "HTTP/1.1 200 OK"
+#define HTTP_206 "HTTP/1.1 206 Partial Content"
+#define HTTP_415 "HTTP/1.1 415 Unsupported Media Type"
+#define HTTP_416 "HTTP/1.1 416 Range Not Satisfiable"
 
 #define HTTP_400_BODY "<html><head>" \
     "<title>400 Bad Request</title>" \
@@ -30,6 +42,24 @@
     "</body>" \
     "</html>"
 
+#define HTTP_415_BODY "<html><head>" \
+    "<title>415 Unsupported Media Type</title>" \
+    "</head>" \
+    "<body>" \
+    "<h1>Calaos Server - Unsupported Media Type</h1>" \
+    "<p>The file can't be converted to the requested format.</p>" \
+    "</body>" \
+    "</html>"
+
+#define HTTP_416_BODY "<html><head>" \
+    "<title>416 Range Not Satisfiable</title>" \
+    "</head>" \
+    "<body>" \
+    "<h1>Calaos Server - Range Not Satisfiable</h1>" \
+    "<p>The requested range is outside of the file.</p>" \
+    "</body>" \
+    "</html>"
+
 #define HTTP_500_BODY "<html><head>" \
     "<title>500 Internal Server Error</title>" \
     "</head>" \
@@ -39,12 +69,35 @@
     "</body>" \
     "</html>"
 
+/* A parsed request, waiting for its response */
+struct HttpRequest
+{
+    QByteArray url;
+    unsigned char method;
+    QHash<QString, QString> headers; /* Lower case names */
+    bool keepAlive;
+    bool http11; /* Chunked transfer encoding allowed */
+};
 
+/* One connection of the HttpServer.
+ * Connections are persistent (HTTP/1.1 keep-alive) and the requests can be
+ * pipelined: they are queued by the parser and answered in order. An idle
+ * connection is closed after keepAliveTimeout ms.
+ * /track/<id> streams the file of a track of the database (with Range
+ * support, for seeking), with at most streamBandwidth bytes/s (0 for no
+ * limit). With the parameters format=flac, max_rate=<Hz> or bits=<bits>,
+ * the track is transcoded on the fly for the slow links.
+ * /atlas/albums?page=<page>&size=<pixels> gives the JSON map of a sprite
+ * sheet of album covers (see CoverAtlas), the image is a file of the cache.
+ * A page after the last album is not found (404).
+ * Any other path is a file of the cache directory.
+ */
 class HttpClient : public QObject
 {
     Q_OBJECT
 public:
-    explicit HttpClient(QTcpSocket *socket, QString cacheDirectory, QObject *parent);
+    explicit HttpClient(QTcpSocket *socket, QString cacheDirectory, int keepAliveTimeout,
+                        int streamBandwidth, QObject *parent);
     ~HttpClient();
 
 private:
@@ -62,8 +115,43 @@ private:
     unsigned char m_requestMethod;
     QHash<QString, QString> m_requestHeaders;
 
-    void parseRequest();
-    void CloseConnection();
+    QQueue<HttpRequest> m_requests;
+    QTimer m_idleTimer;
+
+    /* Image waiting for its thumbnail */
+    QString m_pendingImage;
+    int m_pendingSize;
+    HttpRequest m_pendingRequest;
+
+    /* Atlas waiting to be made (m_pendingAtlasSize is 0 if none) */
+    unsigned long long m_pendingAtlasGeneration;
+    int m_pendingAtlasPage;
+    int m_pendingAtlasSize;
+
+    /* Track being sent (TrackStream or TranscodeStream), the next requests
+     * wait for its end
+     */
+    QObject *m_stream;
+    int m_streamBandwidth;
+
+    bool parseRequest();
+    void processRequests();
+    bool responsePending();
+    bool handleRequest(HttpRequest &request);
+    void sendImage(const QString &path, const QString &extension, const HttpRequest &request);
+    void sendImage(const ImageCacheEntry &entry, const HttpRequest &request);
+    bool loadImage(const QString &path, const QString &extension, ImageCacheEntry *entry);
+    bool streamTrack(const QString &path, HttpRequest &request);
+    bool transcodeTrack(const EMSTrack &track, const QUrlQuery &query, HttpRequest &request, bool *transcoded);
+    static int outputRate(int sourceRate, int maxRate);
+    static bool parseRange(const QString &range, qint64 fileSize, qint64 *offset, qint64 *length);
+    static QString audioMimeType(const QString &extension);
+    bool sendAtlas(const QUrlQuery &query, const HttpRequest &request);
+    void sendAtlasMap(const QString &path, const HttpRequest &request);
+    void sendError(QString code, const char *html, const HttpRequest &request);
+    void writeResponse(const QByteArray &response);
+    static QString httpDate(const QDateTime &date);
+    static QDateTime parseHttpDate(const QString &date);
     QByteArray buildHttpResponse(QString code, QHash<QString, QString> &headers, QByteArray &body);
 
     friend int onMessageBeginCb(http_parser *parser);
@@ -78,6 +166,12 @@ private:
 signals:
 
 public slots:
+
+private slots:
+    void thumbnailReady(QString path, int size, QString thumbnail);
+    void streamFinished(bool success);
+    void atlasReady(unsigned long long generation, int page, int size, QString map);
+    void CloseConnection();
 };
 
 #endif // HTTPCLIENT_H
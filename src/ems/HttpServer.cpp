@@ -1,9 +1,38 @@
 #include <QSettings>
 #include <QCoreApplication>
 #include <QStandardPaths>
+#include <signal.h>
 #include "HttpServer.h"
 #include "DefaultSettings.h"
 
+HttpWorker::HttpWorker(int workerId, QString cacheDirectory, int keepAliveTimeout, int streamBandwidth) :
+    QObject(0),
+    m_workerId(workerId),
+    m_cacheDirectory(cacheDirectory),
+    m_keepAliveTimeout(keepAliveTimeout),
+    m_streamBandwidth(streamBandwidth)
+{
+}
+
+void HttpWorker::addConnection(qintptr socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket;
+    if (!socket->setSocketDescriptor(socketDescriptor))
+    {
+        qCritical() << "HttpWorker: invalid connection (" << socket->errorString() << ")";
+        delete socket;
+        emit connectionClosed(m_workerId);
+        return;
+    }
+
+    //memory is freed when connection is closed automatically
+    HttpClient *client = new HttpClient(socket, m_cacheDirectory, m_keepAliveTimeout, m_streamBandwidth, this);
+    connect(client, &QObject::destroyed, this, [=]()
+    {
+        emit connectionClosed(m_workerId);
+    });
+}
+
 HttpServer::HttpServer(QObject *parent) :
     QObject(parent),
     m_tcpServer(0)
@@ -12,38 +41,113 @@ HttpServer::HttpServer(QObject *parent) :
 
     EMS_LOAD_SETTINGS(m_cacheDirectory, "main/cache_directory",
                       QStandardPaths::standardLocations(QStandardPaths::CacheLocation)[0], String);
+    EMS_LOAD_SETTINGS(m_keepAliveTimeout, "main/http_keepalive_timeout",
+                      EMS_HTTP_KEEPALIVE_TIMEOUT, Int);
+    EMS_LOAD_SETTINGS(m_streamBandwidth, "main/http_stream_bandwidth",
+                      EMS_HTTP_STREAM_BANDWIDTH, Int);
+    EMS_LOAD_SETTINGS(m_nbThreads, "main/http_threads",
+                      EMS_HTTP_THREADS, Int);
+    EMS_LOAD_SETTINGS(m_maxConnections, "main/http_max_connections",
+                      EMS_HTTP_MAX_CONNECTIONS, Int);
 
+    if (m_nbThreads < 1)
+    {
+        m_nbThreads = 1;
+    }
+    if (m_maxConnections < 1)
+    {
+        m_maxConnections = 1;
+    }
+
+    m_streamBandwidth = qMax(0, m_streamBandwidth) * 1024;
+
+    /* A client closing a track stream must not kill EMS (sendfile has no MSG_NOSIGNAL) */
+    signal(SIGPIPE, SIG_IGN);
+
+    qRegisterMetaType<qintptr>("qintptr");
 }
 
 HttpServer::~HttpServer()
 {
-
+    /* The workers and their clients are deleted by their thread */
+    foreach (QThread *thread, m_threads)
+    {
+        thread->quit();
+        thread->wait();
+    }
 }
 
 bool HttpServer::start(quint16 port)
 {
     bool ret = false;
-    m_tcpServer = new QTcpServer(this);
+    m_tcpServer = new HttpListener(this);
 
     ret = m_tcpServer->listen(QHostAddress(QHostAddress::AnyIPv4), port);
     if (!ret)
     {
         delete m_tcpServer;
+        m_tcpServer = 0;
         return ret;
     }
 
-    qDebug() << "Http server listening on port " << port;
-    connect(m_tcpServer, &QTcpServer::newConnection, [=]()
+    for (int i=0; i<m_nbThreads; i++)
     {
-        while (m_tcpServer->hasPendingConnections())
-        {
-            QTcpSocket *socket = m_tcpServer->nextPendingConnection();
-            //memory is freed when connection is closed automatically
-            new HttpClient(socket, m_cacheDirectory, m_tcpServer);
-        }
-    });
+        QThread *thread = new QThread(this);
+        HttpWorker *worker = new HttpWorker(i, m_cacheDirectory, m_keepAliveTimeout, m_streamBandwidth);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        connect(worker, &HttpWorker::connectionClosed, this, &HttpServer::connectionClosed);
+        thread->start();
+
+        m_threads.append(thread);
+        m_workers.append(worker);
+        m_connections.append(0);
+    }
+
+    qDebug() << "Http server listening on port " << port << "with" << m_nbThreads << "threads";
+    connect(m_tcpServer, &HttpListener::newDescriptor, this, &HttpServer::newDescriptor);
 
     return ret;
 
 }
 
+void HttpServer::newDescriptor(qintptr socketDescriptor)
+{
+    m_pendingDescriptors.enqueue(socketDescriptor);
+    dispatch();
+}
+
+void HttpServer::connectionClosed(int workerId)
+{
+    m_connections[workerId]--;
+    dispatch();
+}
+
+/* Give the waiting connections to the least loaded threads */
+void HttpServer::dispatch()
+{
+    while (!m_pendingDescriptors.isEmpty())
+    {
+        int best = -1;
+        for (int i=0; i<m_workers.size(); i++)
+        {
+            if (m_connections.at(i) < m_maxConnections &&
+                (best < 0 || m_connections.at(i) < m_connections.at(best)))
+            {
+                best = i;
+            }
+        }
+
+        if (best < 0)
+        {
+            /* All the threads are full: the next clients wait in the backlog */
+            m_tcpServer->pauseAccepting();
+            return;
+        }
+
+        m_connections[best]++;
+        QMetaObject::invokeMethod(m_workers.at(best), "addConnection", Qt::QueuedConnection,
+                                  Q_ARG(qintptr, m_pendingDescriptors.dequeue()));
+    }
+    m_tcpServer->resumeAccepting();
+}
@@ -4,10 +4,54 @@
 #include <QObject>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QThread>
+#include <QVector>
+#include <QQueue>
 
 
 #include "HttpClient.h"
 
+/* Accept the connections, the sockets are created by the HttpWorkers */
+class HttpListener : public QTcpServer
+{
+    Q_OBJECT
+public:
+    HttpListener(QObject *parent = 0) : QTcpServer(parent) {}
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) { emit newDescriptor(socketDescriptor); }
+
+signals:
+    void newDescriptor(qintptr socketDescriptor);
+};
+
+/* Event loop thread of the HttpServer: its HttpClients live in it */
+class HttpWorker : public QObject
+{
+    Q_OBJECT
+public:
+    HttpWorker(int workerId, QString cacheDirectory, int keepAliveTimeout, int streamBandwidth);
+
+private:
+    int m_workerId;
+    QString m_cacheDirectory;
+    int m_keepAliveTimeout;
+    int m_streamBandwidth;
+
+signals:
+    void connectionClosed(int workerId);
+
+public slots:
+    void addConnection(qintptr socketDescriptor);
+};
+
+/* HTTP server of the cache directory (covers) and of the tracks.
+ * The connections are served by main/http_threads event loop threads, out
+ * of the main thread of EMS (player and WebSocket API). A new connection
+ * goes to the thread with the fewest connections. When all the threads have
+ * main/http_max_connections connections, the new ones wait in the listen
+ * backlog.
+ */
 class HttpServer: QObject
 {
     Q_OBJECT
@@ -18,10 +62,23 @@ public:
     bool start(quint16 port);
 
 private:
-    QTcpServer *m_tcpServer;
+    HttpListener *m_tcpServer;
     QString m_cacheDirectory;
+    int m_keepAliveTimeout;
+    int m_streamBandwidth; /* Bytes/s per track stream */
+    int m_nbThreads;
+    int m_maxConnections; /* Per thread */
+
+    QVector<QThread *> m_threads;
+    QVector<HttpWorker *> m_workers;
+    QVector<int> m_connections; /* By worker */
+    QQueue<qintptr> m_pendingDescriptors;
+
+    void dispatch();
 
 private slots:
+    void newDescriptor(qintptr socketDescriptor);
+    void connectionClosed(int workerId);
 };
 
 #endif // HTTPSERVER_H
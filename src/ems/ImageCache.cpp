@@ -0,0 +1,68 @@
+#include <QDebug>
+#include <QSettings>
+#include <QFileInfo>
+
+#include "DefaultSettings.h"
+#include "ImageCache.h"
+
+ImageCache* ImageCache::_instance = 0;
+
+ImageCache::ImageCache()
+{
+    QSettings settings;
+    int cacheSize;
+    EMS_LOAD_SETTINGS(cacheSize, "main/http_image_cache_size",
+                      EMS_HTTP_IMAGE_CACHE_SIZE, Int);
+
+    m_entries.setMaxCost(qMax(cacheSize, 0) * 1024);
+
+    /* A few big originals must not evict all the thumbnails */
+    m_maxEntrySize = m_entries.maxCost() / 16;
+}
+
+bool ImageCache::find(const QString &path, ImageCacheEntry *entry)
+{
+    bool found = false;
+
+    m_mutex.lock();
+    ImageCacheEntry *cached = m_entries.object(path);
+    if (cached)
+    {
+        *entry = *cached;
+        found = true;
+    }
+    m_mutex.unlock();
+
+    if (found && !entry->immutable)
+    {
+        QFileInfo fi(path);
+        if (!fi.exists() || fi.size() != entry->fileSize ||
+            fi.lastModified().toMSecsSinceEpoch() != entry->mtime)
+        {
+            remove(path);
+            found = false;
+        }
+    }
+
+    return found;
+}
+
+void ImageCache::insert(const QString &path, const ImageCacheEntry &entry)
+{
+    int cost = entry.response.size() + entry.headers.size();
+    if (cost > m_maxEntrySize)
+    {
+        return;
+    }
+
+    m_mutex.lock();
+    m_entries.insert(path, new ImageCacheEntry(entry), cost);
+    m_mutex.unlock();
+}
+
+void ImageCache::remove(const QString &path)
+{
+    m_mutex.lock();
+    m_entries.remove(path);
+    m_mutex.unlock();
+}
@@ -0,0 +1,69 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include <QDateTime>
+
+/* An image served by the HttpClient, with its headers already serialized */
+class ImageCacheEntry
+{
+public:
+    QByteArray headers;  /* Header lines, without Connection */
+    QByteArray response; /* Complete 200 response for a persistent connection */
+    int bodyOffset;      /* Position of the image in response */
+    QString etag;
+    QDateTime lastModified; /* UTC, to the second */
+    qint64 mtime;        /* In ms, to check the file */
+    qint64 fileSize;
+    bool immutable;      /* Content-addressed cover: the file is never checked */
+
+    QByteArray body() const { return response.mid(bodyOffset); }
+};
+
+/* Last served images (mostly thumbnails of covers), kept in memory so that
+ * scrolling an album grid does not read the storage again. The cache is an
+ * LRU limited to main/http_image_cache_size KiB, bigger images are not
+ * kept. An entry is dropped when its file changes (size or mtime), except
+ * for the content-addressed covers which never change.
+ */
+class ImageCache
+{
+public:
+    /* Thread safe API */
+    bool find(const QString &path, ImageCacheEntry *entry);
+    void insert(const QString &path, const ImageCacheEntry &entry);
+    void remove(const QString &path);
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static ImageCache* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new ImageCache;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+private:
+    QMutex m_mutex;
+    QCache<QString, ImageCacheEntry> m_entries; /* Cost in bytes */
+    int m_maxEntrySize;
+
+    static ImageCache* _instance;
+    ImageCache();
+    ImageCache(const ImageCache &);
+    ImageCache& operator=(const ImageCache &);
+};
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,391 @@
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+
+#include "DefaultSettings.h"
+#include "IngestionQueue.h"
+#include "Database.h"
+
+IngestionQueue::IngestionQueue(QObject *parent) :
+    QObject(parent),
+    m_flushTimer(this)
+{
+    QSettings settings;
+    int batchPeriod;
+    EMS_LOAD_SETTINGS(m_batchSize, "main/scan_batch_size",
+                      EMS_SCAN_BATCH_SIZE, Int);
+    EMS_LOAD_SETTINGS(batchPeriod, "main/scan_batch_period",
+                      EMS_SCAN_BATCH_PERIOD, Int);
+    EMS_LOAD_SETTINGS(m_maxRetries, "main/scan_batch_retries",
+                      EMS_SCAN_BATCH_RETRIES, Int);
+
+    m_nbUnchangedFiles = 0;
+    m_scanId = 0;
+    m_failedFlushes = 0;
+    m_flushTimer.setInterval(batchPeriod);
+    connect(&m_flushTimer, &QTimer::timeout, this, &IngestionQueue::flush);
+}
+
+IngestionQueue::~IngestionQueue()
+{
+
+}
+
+void IngestionQueue::start()
+{
+    m_flushTimer.start();
+}
+
+void IngestionQueue::stop()
+{
+    m_flushTimer.stop();
+    flush();
+}
+
+void IngestionQueue::addFoundFile(const EMSTrack &track, QSharedPointer<FileProbe> probe)
+{
+    m_mutex.lock();
+    m_foundFiles.append(track);
+    /* Not while the database fails: the batches are waiting */
+    if (probe && m_failedFlushes == 0)
+    {
+        m_foundProbes.insert(track.filename, probe);
+    }
+    bool full = isFull();
+    m_mutex.unlock();
+
+    if (full)
+    {
+        flush();
+    }
+}
+
+void IngestionQueue::addUnchangedFile(const QString &filename, unsigned long long timestamp)
+{
+    m_mutex.lock();
+    m_unchangedFiles[timestamp].append(filename);
+    m_nbUnchangedFiles++;
+    bool full = isFull();
+    m_mutex.unlock();
+
+    if (full)
+    {
+        flush();
+    }
+}
+
+void IngestionQueue::addCompleteTrack(const EMSTrack &track)
+{
+    m_mutex.lock();
+    m_completeTracks.append(track);
+    bool full = isFull();
+    m_mutex.unlock();
+
+    if (full)
+    {
+        flush();
+    }
+}
+
+void IngestionQueue::addEnrichedTrack(const EMSTrack &track)
+{
+    m_mutex.lock();
+    m_enrichedTracks.append(track);
+    bool full = isFull();
+    m_mutex.unlock();
+
+    if (full)
+    {
+        flush();
+    }
+}
+
+/* All the files of the directory have been given to this queue */
+void IngestionQueue::addCompletedDirectory(const QString &directory)
+{
+    m_mutex.lock();
+    m_completedDirectories.append(directory);
+    m_mutex.unlock();
+}
+
+/* Record the completed directories for this scan (0 to stop recording) */
+void IngestionQueue::setScan(unsigned long long scanId)
+{
+    Database *db = Database::instance();
+
+    m_mutex.lock();
+    m_scanId = scanId;
+    m_completedDirectories.clear();
+    m_mutex.unlock();
+
+    db->lock();
+    m_pendingFiles.clear();
+    m_waitingDirectories.clear();
+    db->unlock();
+}
+
+/* Must be called with m_mutex locked.
+ * After a failure, the database is not tried again before the timer.
+ */
+bool IngestionQueue::isFull()
+{
+    return m_failedFlushes == 0 &&
+           (m_foundFiles.size() + m_nbUnchangedFiles + m_completeTracks.size() +
+            m_enrichedTracks.size()) >= m_batchSize;
+}
+
+/* Write all the buffered data in the database, in one transaction.
+ * It can be called from any thread : the buffers are swapped under the
+ * mutex, and m_flushMutex serializes the concurrent flushes up to their
+ * commit.
+ */
+void IngestionQueue::flush()
+{
+    QVector<EMSTrack> foundFiles;
+    QHash<QString, QSharedPointer<FileProbe> > foundProbes;
+    QMap<unsigned long long, QStringList> unchangedFiles;
+    QVector<EMSTrack> completeTracks;
+    QVector<EMSTrack> enrichedTracks;
+    QStringList completedDirectories;
+    unsigned long long scanId;
+
+    QMutexLocker flushLocker(&m_flushMutex);
+    m_mutex.lock();
+    foundFiles.swap(m_foundFiles);
+    foundProbes.swap(m_foundProbes);
+    unchangedFiles.swap(m_unchangedFiles);
+    m_nbUnchangedFiles = 0;
+    completeTracks.swap(m_completeTracks);
+    enrichedTracks.swap(m_enrichedTracks);
+    completedDirectories.swap(m_completedDirectories);
+    scanId = m_scanId;
+    m_mutex.unlock();
+
+    if (foundFiles.isEmpty() && unchangedFiles.isEmpty() && completeTracks.isEmpty() &&
+        enrichedTracks.isEmpty() && completedDirectories.isEmpty())
+    {
+        return;
+    }
+
+    QStringList sha1List;
+    foreach (const EMSTrack &track, foundFiles)
+    {
+        sha1List << track.sha1;
+    }
+
+    /* storeTrack() and findAlbum() modify the tracks: the batch is given
+     * back as it was taken if the transaction fails
+     */
+    QVector<EMSTrack> takenCompleteTracks = completeTracks;
+    QVector<EMSTrack> takenEnrichedTracks = enrichedTracks;
+
+    QVector<EMSTrack> unknownFiles;
+    Database *db = Database::instance();
+    db->lock();
+    if (!db->beginTransaction())
+    {
+        db->unlock();
+        qCritical() << "IngestionQueue: unable to begin the transaction of the batch";
+        requeue(foundFiles, unchangedFiles, takenCompleteTracks, takenEnrichedTracks,
+                completedDirectories, scanId);
+        return;
+    }
+    QHash<QString, int> pendingFiles = m_pendingFiles;
+    QSet<QString> waitingDirectories = m_waitingDirectories;
+
+    /* 1) Files already scanned, only refresh their timestamp */
+    QMapIterator<unsigned long long, QStringList> it(unchangedFiles);
+    while (it.hasNext())
+    {
+        it.next();
+        db->updateFilenamesTimestamp(it.value(), it.key());
+    }
+
+    /* 2) Search existing sha1 in the database */
+    QHash<QString, unsigned long long> trackIDs;
+    db->getTrackIdsBySha1(&trackIDs, sha1List);
+    foreach (const EMSTrack &track, foundFiles)
+    {
+        if (trackIDs.contains(track.sha1))
+        {
+            /* Do nothing as we assume the metadata have correctly been seeked */
+            db->insertNewFilename(track.filename, trackIDs.value(track.sha1), track.lastscan, track.fileStat);
+        }
+        else
+        {
+            unknownFiles.append(track);
+            m_pendingFiles[QFileInfo(track.filename).absolutePath()]++;
+        }
+    }
+
+    /* 3) New tracks with the metadata of the local plugins */
+    QStringList checkpoints;
+    for (int i=0; i<completeTracks.size(); i++)
+    {
+        storeTrack(&(completeTracks[i]));
+
+        QString directory = QFileInfo(completeTracks[i].filename).absolutePath();
+        QHash<QString, int>::iterator pending = m_pendingFiles.find(directory);
+        if (pending != m_pendingFiles.end() && --pending.value() <= 0)
+        {
+            m_pendingFiles.erase(pending);
+            if (m_waitingDirectories.remove(directory))
+            {
+                checkpoints << directory;
+            }
+        }
+    }
+
+    /* 4) Tracks already stored, with the data of the other plugins */
+    for (int i=0; i<enrichedTracks.size(); i++)
+    {
+        findAlbum(&(enrichedTracks[i]));
+        db->updateTrack(&(enrichedTracks[i]));
+    }
+
+    /* 5) Checkpoints: the directories whose files are all in the database */
+    foreach (const QString &directory, completedDirectories)
+    {
+        if (m_pendingFiles.contains(directory))
+        {
+            m_waitingDirectories.insert(directory);
+        }
+        else
+        {
+            checkpoints << directory;
+        }
+    }
+    if (scanId != 0)
+    {
+        db->insertScanDirectories(scanId, checkpoints);
+    }
+
+    if (!db->commitTransaction())
+    {
+        /* Rolled back: nothing of this batch is in the database */
+        m_pendingFiles = pendingFiles;
+        m_waitingDirectories = waitingDirectories;
+        db->unlock();
+        qCritical() << "IngestionQueue: unable to commit the batch";
+        requeue(foundFiles, unchangedFiles, takenCompleteTracks, takenEnrichedTracks,
+                completedDirectories, scanId);
+        return;
+    }
+    db->unlock();
+    m_mutex.lock();
+    m_failedFlushes = 0;
+    m_mutex.unlock();
+    flushLocker.unlock();
+
+    if (completeTracks.size() > 0 || enrichedTracks.size() > 0 || unknownFiles.size() > 0)
+    {
+        qDebug() << "IngestionQueue: " << completeTracks.size() << " new tracks, "
+                 << enrichedTracks.size() << " enriched tracks, "
+                 << (foundFiles.size() - unknownFiles.size()) << " known files, "
+                 << unknownFiles.size() << " files to analyze";
+    }
+
+    /* The probes of the known files are released with this batch */
+    foreach (const EMSTrack &track, unknownFiles)
+    {
+        QSharedPointer<FileProbe> probe = foundProbes.value(track.filename);
+        if (probe)
+        {
+            FileProbeCache::instance()->insert(probe);
+        }
+        emit fileNeedUpdate(track);
+    }
+
+    /* The tracks are browsable now, their ID is known */
+    foreach (const EMSTrack &track, completeTracks)
+    {
+        if (track.id != 0)
+        {
+            emit trackStored(track);
+        }
+    }
+}
+
+/* Put a batch which could not be written back in front of the buffers,
+ * or drop it after m_maxRetries failures. Its probes are dropped: the
+ * metadata plugins can open the files again.
+ * Must be called with m_flushMutex locked.
+ */
+void IngestionQueue::requeue(const QVector<EMSTrack> &foundFiles,
+                             const QMap<unsigned long long, QStringList> &unchangedFiles,
+                             const QVector<EMSTrack> &completeTracks,
+                             const QVector<EMSTrack> &enrichedTracks,
+                             const QStringList &completedDirectories,
+                             unsigned long long scanId)
+{
+    m_mutex.lock();
+    if (++m_failedFlushes > m_maxRetries)
+    {
+        m_failedFlushes = 0;
+        m_mutex.unlock();
+        qCritical() << "IngestionQueue: batch dropped after" << m_maxRetries << "retries :"
+                    << foundFiles.size() << "found files," << completeTracks.size() << "new tracks,"
+                    << enrichedTracks.size() << "enriched tracks";
+        return;
+    }
+    m_foundFiles = foundFiles + m_foundFiles;
+    QMapIterator<unsigned long long, QStringList> it(unchangedFiles);
+    while (it.hasNext())
+    {
+        it.next();
+        m_unchangedFiles[it.key()] = it.value() + m_unchangedFiles.value(it.key());
+        m_nbUnchangedFiles += it.value().size();
+    }
+    m_completeTracks = completeTracks + m_completeTracks;
+    m_enrichedTracks = enrichedTracks + m_enrichedTracks;
+    /* Not if the scan has changed meanwhile (setScan) */
+    if (scanId == m_scanId)
+    {
+        m_completedDirectories = completedDirectories + m_completedDirectories;
+    }
+    m_mutex.unlock();
+}
+
+/* Find the album of the track in the database, or insert it.
+ * An album already known by a stored track is kept.
+ * Must be called with the database locked.
+ */
+void IngestionQueue::findAlbum(EMSTrack *track)
+{
+    Database *db = Database::instance();
+    unsigned long long albumId;
+    QString directory = QFileInfo(track->filename).dir().path();
+
+    if (track->id != 0 && track->album.id != 0)
+    {
+        return;
+    }
+
+    if (track->album.name.isEmpty())
+    {
+        track->album.id = 0; /* Unknown album */
+    }
+    else if(db->getAlbumIdByNameAndTrackFilename(&albumId, track->album.name, directory))
+    {
+        track->album.id = albumId;
+    }
+    else
+    {
+        db->insertNewAlbum(&(track->album));
+    }
+}
+
+/* Insert a new track and its album in the database.
+ * Must be called with the database locked.
+ */
+void IngestionQueue::storeTrack(EMSTrack *track)
+{
+    Database *db = Database::instance();
+
+    findAlbum(track);
+    if (!db->insertNewTrack(track))
+    {
+        track->id = 0;
+    }
+}
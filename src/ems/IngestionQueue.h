@@ -0,0 +1,98 @@
+#ifndef INGESTIONQUEUE_H
+#define INGESTIONQUEUE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QTimer>
+#include <QVector>
+#include <QMap>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+
+#include "Data.h"
+#include "FileProbe.h"
+
+/* Buffer between the scanner and the database.
+ * Files found by the DirectoryWorkers and tracks completed by the
+ * MetadataManager are queued here, then written in the database in one
+ * transaction when batchSize items are waiting or every batchPeriod ms.
+ * The existence of the sha1 of the new files is checked with one query
+ * per batch. Files whose sha1 is unknown are given back with the signal
+ * fileNeedUpdate() to retrieve their metadata, their probe (if any) is put
+ * in the FileProbeCache for the metadata plugins.
+ * New tracks are inserted with the data of the local plugins, then given
+ * back with trackStored() to be enriched by the other plugins. The
+ * enriched tracks are updated in the database with the next batch.
+ * The directories completed by the scan are recorded in the same transaction
+ * as their files (see Database::insertScanDirectories), once the new tracks
+ * of the directory are in the database too.
+ * A batch which can't be written is tried again by the timer only, without
+ * its probes, and dropped after main/scan_batch_retries failures.
+ */
+class IngestionQueue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IngestionQueue(QObject *parent = 0);
+    ~IngestionQueue();
+
+    /* Thread safe API */
+    void addFoundFile(const EMSTrack &track, QSharedPointer<FileProbe> probe);
+    void addUnchangedFile(const QString &filename, unsigned long long timestamp);
+    void addCompleteTrack(const EMSTrack &track);
+    void addEnrichedTrack(const EMSTrack &track);
+    void addCompletedDirectory(const QString &directory);
+    void setScan(unsigned long long scanId);
+
+    /* Must be called from the thread of this object */
+    void start();
+    void stop();
+
+private:
+    int m_batchSize;
+    int m_maxRetries;
+    QTimer m_flushTimer;
+
+    /* Protect the buffers */
+    QMutex m_mutex;
+    QVector<EMSTrack> m_foundFiles;
+    QHash<QString, QSharedPointer<FileProbe> > m_foundProbes; /* By filename */
+    QMap<unsigned long long, QStringList> m_unchangedFiles; /* Indexed by timestamp */
+    int m_nbUnchangedFiles;
+    QVector<EMSTrack> m_completeTracks;
+    QVector<EMSTrack> m_enrichedTracks;
+    QStringList m_completedDirectories;
+    unsigned long long m_scanId; /* 0 if the directories are not recorded */
+    int m_failedFlushes; /* Consecutive failures of the batch in front of the buffers */
+
+    /* Held by flush() from the swap of the buffers to the commit: the
+     * batches are committed in the order they were taken, a directory
+     * can't be checkpointed before the batch which holds its files.
+     */
+    QMutex m_flushMutex;
+
+    /* Only used by flush(), with the database locked */
+    QHash<QString, int> m_pendingFiles; /* Files waiting for metadata, by directory */
+    QSet<QString> m_waitingDirectories; /* Completed, but with pending files */
+
+    bool isFull();
+    void requeue(const QVector<EMSTrack> &foundFiles,
+                 const QMap<unsigned long long, QStringList> &unchangedFiles,
+                 const QVector<EMSTrack> &completeTracks,
+                 const QVector<EMSTrack> &enrichedTracks,
+                 const QStringList &completedDirectories,
+                 unsigned long long scanId);
+    void findAlbum(EMSTrack *track);
+    void storeTrack(EMSTrack *track);
+
+signals:
+    void fileNeedUpdate(EMSTrack track);
+    void trackStored(EMSTrack track);
+
+public slots:
+    void flush();
+};
+
+#endif // INGESTIONQUEUE_H
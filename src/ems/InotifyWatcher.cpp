@@ -0,0 +1,190 @@
+#include <QDebug>
+#include <QDirIterator>
+#include <QSocketNotifier>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "InotifyWatcher.h"
+
+#define INOTIFY_DIRECTORY_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                                IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+InotifyWatcher::InotifyWatcher(QObject *parent) :
+    QObject(parent),
+    m_notifier(NULL)
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+    {
+        qCritical() << "InotifyWatcher: unable to initialize inotify: " << strerror(errno);
+        return;
+    }
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &InotifyWatcher::readEvents);
+}
+
+InotifyWatcher::~InotifyWatcher()
+{
+    if (m_notifier)
+    {
+        m_notifier->setEnabled(false);
+        delete m_notifier;
+    }
+    if (m_fd >= 0)
+    {
+        /* Closing the descriptor removes all the watches */
+        close(m_fd);
+    }
+}
+
+bool InotifyWatcher::isValid() const
+{
+    return m_fd >= 0;
+}
+
+int InotifyWatcher::watchedDirectoriesCount() const
+{
+    return m_watches.size();
+}
+
+bool InotifyWatcher::addDirectory(const QString &directory)
+{
+    if (directory.contains("/."))
+    {
+        /* Hidden directories are not scanned */
+        return false;
+    }
+
+    int wd = inotify_add_watch(m_fd, directory.toUtf8().data(), INOTIFY_DIRECTORY_MASK);
+    if (wd < 0)
+    {
+        qCritical() << "InotifyWatcher: unable to watch " << directory << ": " << strerror(errno);
+        if (errno == ENOSPC)
+        {
+            qCritical() << "InotifyWatcher: increase /proc/sys/fs/inotify/max_user_watches";
+        }
+        return false;
+    }
+
+    /* The same directory can be added twice: inotify gives the same descriptor */
+    m_directories.insert(wd, directory);
+    m_watches.insert(directory, wd);
+    return true;
+}
+
+void InotifyWatcher::addTree(const QString &root)
+{
+    if (!isValid() || !addDirectory(root))
+    {
+        return;
+    }
+
+    QDirIterator iterator(root, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks,
+                          QDirIterator::Subdirectories);
+    while (iterator.hasNext())
+    {
+        addDirectory(iterator.next());
+    }
+}
+
+/* The watches of a deleted directory are removed by the kernel, but the
+ * watches of a moved directory must be removed here.
+ */
+void InotifyWatcher::removeTree(const QString &root)
+{
+    QString prefix = root + "/";
+
+    foreach (const QString &directory, m_watches.keys())
+    {
+        if (directory == root || directory.startsWith(prefix))
+        {
+            int wd = m_watches.take(directory);
+            m_directories.remove(wd);
+            inotify_rm_watch(m_fd, wd);
+        }
+    }
+}
+
+void InotifyWatcher::readEvents()
+{
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while ((length = read(m_fd, buffer, sizeof(buffer))) > 0)
+    {
+        char *ptr = buffer;
+        while (ptr < buffer + length)
+        {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                qCritical() << "InotifyWatcher: event queue overflow";
+                emit overflow();
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                /* Watch removed: the directory was deleted or unmounted */
+                QString directory = m_directories.take(event->wd);
+                if (!directory.isEmpty())
+                {
+                    m_watches.remove(directory);
+                }
+                continue;
+            }
+
+            QString directory = m_directories.value(event->wd);
+            if (directory.isEmpty() || event->len == 0)
+            {
+                continue;
+            }
+
+            QString name = QString::fromUtf8(event->name);
+            if (name.startsWith("."))
+            {
+                continue;
+            }
+            QString path = directory + "/" + name;
+
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    /* Its files may have been created before the watch: let the
+                     * receiver scan the whole directory.
+                     */
+                    addTree(path);
+                    emit directoryAdded(path);
+                }
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    removeTree(path);
+                    emit directoryRemoved(path);
+                }
+            }
+            else if (event->mask & IN_CREATE)
+            {
+                emit fileCreated(path);
+            }
+            else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+            {
+                emit fileClosed(path);
+            }
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                emit fileRemoved(path);
+            }
+        }
+    }
+
+    if (length < 0 && errno != EAGAIN)
+    {
+        qCritical() << "InotifyWatcher: error reading the events: " << strerror(errno);
+    }
+}
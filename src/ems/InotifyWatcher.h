@@ -0,0 +1,54 @@
+#ifndef INOTIFYWATCHER_H
+#define INOTIFYWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+
+QT_FORWARD_DECLARE_CLASS(QSocketNotifier)
+
+/* Linux backend of the DirectoriesWatcher, reading the inotify events
+ * directly instead of using QFileSystemWatcher.
+ * Only the directories are watched (one inotify watch per directory), and
+ * each event tells which file has been created, written, moved or deleted.
+ * New subdirectories are watched as soon as they are created.
+ */
+class InotifyWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit InotifyWatcher(QObject *parent = 0);
+    ~InotifyWatcher();
+
+    bool isValid() const;
+
+    /* Watch the directory and all its subdirectories */
+    void addTree(const QString &root);
+    int watchedDirectoriesCount() const;
+
+private:
+    int m_fd;
+    QSocketNotifier *m_notifier;
+    QHash<int, QString> m_directories; /* Indexed by watch descriptor */
+    QHash<QString, int> m_watches; /* Indexed by directory */
+
+    bool addDirectory(const QString &directory);
+    void removeTree(const QString &root);
+
+signals:
+    /* A file appeared, its content may not be written yet */
+    void fileCreated(QString filename);
+    /* A file is complete: closed after writing or moved in a watched directory */
+    void fileClosed(QString filename);
+    /* A file was deleted or moved out of its directory */
+    void fileRemoved(QString filename);
+    void directoryAdded(QString directory);
+    void directoryRemoved(QString directory);
+    /* Some events were lost, everything has to be scanned again */
+    void overflow();
+
+private slots:
+    void readEvents();
+};
+
+#endif // INOTIFYWATCHER_H
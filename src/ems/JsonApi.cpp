@@ -1662,6 +1662,21 @@ void JsonApi::sendRipProgress(EMSRipProgress ripProgress)
     m_webSocket->sendTextMessage(doc.toJson(QJsonDocument::Compact));
 }
 
+void JsonApi::sendScanProgress(EMSScanProgress scanProgress)
+{
+    QJsonObject scanProgressJsonObj;
+    scanProgressJsonObj["msg"] = "EMS_SCAN";
+    scanProgressJsonObj["phase"] = scanProgress.phase;
+    scanProgressJsonObj["files_seen"] = (qint64)scanProgress.files_seen;
+    scanProgressJsonObj["files_new"] = (qint64)scanProgress.files_new;
+    scanProgressJsonObj["files_per_second"] = scanProgress.files_per_second;
+    scanProgressJsonObj["mb_per_second"] = scanProgress.mb_per_second;
+    scanProgressJsonObj["eta"] = scanProgress.eta;
+
+    QJsonDocument doc(scanProgressJsonObj);
+    m_webSocket->sendTextMessage(doc.toJson(QJsonDocument::Compact));
+}
+
 void JsonApi::sendMenu()
 {
     QJsonObject unused;
@@ -31,6 +31,7 @@ public:
     void sendPlaylist(EMSPlaylist newPlaylist);
     void sendAuthRequest(EMSClient client);
     void sendRipProgress(EMSRipProgress ripProgress);
+    void sendScanProgress(EMSScanProgress scanProgress);
     void sendMenu();
     void sendWifiConnected();
     void sendEthConnected();
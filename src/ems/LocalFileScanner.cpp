@@ -10,22 +10,47 @@
 #include "DirectoryWorker.h"
 #include "MetadataManager.h"
 #include "Database.h"
+#include "ScanMonitor.h"
+#include "CoverStore.h"
 
 LocalFileScanner::LocalFileScanner(QObject *parent) : QObject(parent)
 {
     QSettings settings;
     EMS_LOAD_SETTINGS(m_supportedFormat, "main/music_extensions",
                       EMS_MUSIC_EXTENSIONS, String);
+    EMS_LOAD_SETTINGS(m_nbWorkers, "main/scan_workers",
+                      EMS_SCAN_WORKERS, Int);
+    if (m_nbWorkers <= 0)
+    {
+        m_nbWorkers = QThread::idealThreadCount();
+    }
+    if (m_nbWorkers <= 0)
+    {
+        m_nbWorkers = 1;
+    }
+    EMS_LOAD_SETTINGS(m_rotationalWorkers, "main/scan_rotational_workers",
+                      EMS_SCAN_ROTATIONAL_WORKERS, Int);
+    EMS_LOAD_SETTINGS(m_otherWorkers, "main/scan_other_workers",
+                      EMS_SCAN_OTHER_WORKERS, Int);
 
     m_scanActive = false;
+    m_queue = NULL;
+    m_scanId = 0;
+
+    /* Moved to the thread of the scanner with this object */
+    m_ingestion = new IngestionQueue(this);
+    connect(m_ingestion, SIGNAL(fileNeedUpdate(EMSTrack)), this, SLOT(fileNeedUpdate(EMSTrack)), Qt::DirectConnection);
+    connect(m_ingestion, SIGNAL(trackStored(EMSTrack)), this, SLOT(trackStored(EMSTrack)), Qt::DirectConnection);
 
     connect(this, SIGNAL(trackNeedUpdate(EMSTrack, QStringList)), MetadataManager::instance(), SLOT(update(EMSTrack,QStringList)));
+    connect(this, SIGNAL(trackNeedEnrichment(EMSTrack, QStringList)), MetadataManager::instance(), SLOT(enrich(EMSTrack,QStringList)));
     connect(MetadataManager::instance(), SIGNAL(updated(EMSTrack,bool)), this, SLOT(trackUpdated(EMSTrack,bool)));
 }
 
 LocalFileScanner::~LocalFileScanner()
 {
     disconnect(this, SIGNAL(trackNeedUpdate(EMSTrack,QStringList)), MetadataManager::instance(), SLOT(update(EMSTrack,QStringList)));
+    disconnect(this, SIGNAL(trackNeedEnrichment(EMSTrack,QStringList)), MetadataManager::instance(), SLOT(enrich(EMSTrack,QStringList)));
     connect(MetadataManager::instance(), SIGNAL(updated(EMSTrack,bool)), this, SLOT(trackUpdated(EMSTrack,bool)));
 }
 
@@ -38,23 +63,91 @@ void LocalFileScanner::startScan()
     m_scanActive = true;
     m_startTime = QDateTime::currentDateTime().toTime_t();
     m_measureTime.start();
+    m_ingestion->start();
+    CoverStore::instance()->clearDirectoryCache();
+
+    /* Resume the scan interrupted by the last stop of EMS, if any: the files
+     * it has already seen have its start time, so they won't be removed by
+     * the final cleanup, and its completed directories are not read again.
+     */
+    Database *db = Database::instance();
+    unsigned long long resumedStartTime;
+    QStringList resumedScope;
+    m_scanId = 0;
+    m_completedDirectories.clear();
+    db->lock();
+    if (db->getUnfinishedScan(&m_scanId, &resumedStartTime, &resumedScope))
+    {
+        m_startTime = resumedStartTime;
+        if (resumedScope.isEmpty() || m_scope.isEmpty())
+        {
+            m_scope.clear();
+        }
+        else
+        {
+            foreach (const QString &directory, resumedScope)
+            {
+                if (!m_scope.contains(directory))
+                {
+                    m_scope << directory;
+                }
+            }
+        }
+        db->getScanDirectories(m_scanId, &m_completedDirectories);
+        qDebug() << "Resuming the scan" << m_scanId << ":" << m_completedDirectories.size()
+                 << "directories already done";
+    }
+    m_scanRoots = computeScanRoots();
+    db->saveScan(&m_scanId, m_startTime, m_scope.isEmpty() ? QStringList() : m_scanRoots);
+    db->unlock();
+    m_ingestion->setScan(m_scanId);
 
-    qDebug() << "Starting local file scanner...";
+    qDebug() << "Starting local file scanner with" << m_nbWorkers << "workers in" << m_scanRoots;
 
-    for (int i=0; i<m_locations.size(); i++)
+    /* Files with the same stat() data as in the last scan are not hashed again */
+    m_knownFiles.clear();
+    db->lock();
+    if (m_scope.isEmpty())
+    {
+        db->getFilesStat(&m_knownFiles);
+    }
+    else
+    {
+        foreach (const QString &root, m_scanRoots)
+        {
+            db->getFilesStat(&m_knownFiles, root);
+        }
+    }
+    db->unlock();
+    qDebug() << m_knownFiles.size() << "files are already known by the database";
+    ScanMonitor::instance()->start(m_knownFiles.size());
+
+    /* All the workers share the same queue of directories to scan.
+     * The root of each location (or each modified directory) is the first work item.
+     * The queue limits the number of workers on each device.
+     */
+    m_queue = new DirectoryQueue(m_nbWorkers, m_rotationalWorkers, m_otherWorkers);
+    for (int i=0; i<m_scanRoots.size(); i++)
+    {
+        m_queue->push(i, m_scanRoots.at(i));
+    }
+
+    for (int i=0; i<m_nbWorkers; i++)
     {
-        QString location = m_locations.at(i);
         // Create a new qthread
         QThread *directoryThread = new QThread;
-        // Create the DirectoryWorker object : it scan directory recusively in a thread
+        // Create the DirectoryWorker object : it takes directories from the shared queue
         // And send fileFound() signal when a new file is found
-        DirectoryWorker* dirWorker = new DirectoryWorker(location, m_supportedFormat);
+        DirectoryWorker* dirWorker = new DirectoryWorker(m_queue, i, m_supportedFormat, &m_knownFiles,
+                                                         &m_completedDirectories);
         m_workers.append(dirWorker);
         // Move object to specific thread
         dirWorker->moveToThread(directoryThread);
         // Call fileFound slot when a new file is found
         connect(directoryThread, SIGNAL(started()), dirWorker, SLOT(process()));
-        connect(dirWorker, SIGNAL(fileFound(QString, QString)), this, SLOT(fileFound(QString, QString)), Qt::DirectConnection);
+        connect(dirWorker, SIGNAL(fileFound(QString, QString, EMSFileStat, QSharedPointer<FileProbe>)), this, SLOT(fileFound(QString, QString, EMSFileStat, QSharedPointer<FileProbe>)), Qt::DirectConnection);
+        connect(dirWorker, SIGNAL(fileUnchanged(QString)), this, SLOT(fileUnchanged(QString)), Qt::DirectConnection);
+        connect(dirWorker, SIGNAL(directoryScanned(QString)), this, SLOT(directoryScanned(QString)), Qt::DirectConnection);
         connect(dirWorker, SIGNAL(finished(DirectoryWorker*)), this, SLOT(workerFinished(DirectoryWorker*)));
         // Start the thread
         directoryThread->start();
@@ -94,6 +187,9 @@ void LocalFileScanner::workerFinished(DirectoryWorker* worker)
     if (m_workers.empty())
     {
         /* No more worker */
+        delete m_queue;
+        m_queue = NULL;
+        m_knownFiles.clear();
         scanEnd();
     }
 }
@@ -106,35 +202,72 @@ void LocalFileScanner::scanEnd()
     t = t.addMSecs(m_measureTime.elapsed());
     qDebug() << "Scan finished. (duration: " << t.toString("HH:mm:ss.zzz") << ")";
 
+    /* Timestamps of the files found by the workers must be written before cleaning */
+    ScanMonitor::instance()->setPhase("db");
+    m_ingestion->flush();
+
     qDebug() << "Clean database... (remove non-existent files, ...)";
+    ScanMonitor::instance()->setPhase("cleanup");
     db->lock();
-    for (int i=0; i<m_locations.size(); i++)
+    if (m_scope.isEmpty())
     {
-        QString location = m_locations.at(i);
-        db->removeOldFiles(location, m_startTime);
+        for (int i=0; i<m_locations.size(); i++)
+        {
+            QString location = m_locations.at(i);
+            db->removeOldFiles(location, m_startTime);
+        }
+        db->cleanOrphans();
+    }
+    else
+    {
+        /* Only the tracks of the removed files can become orphans */
+        QSet<unsigned long long> trackIds;
+        foreach (const QString &root, m_scanRoots)
+        {
+            db->removeOldFiles(root, m_startTime, &trackIds);
+        }
+        db->cleanOrphans(trackIds);
     }
-    db->cleanOrphans();
+
+    /* All the directories have been covered: nothing to resume */
+    db->removeScan(m_scanId);
     db->unlock();
+    m_ingestion->setScan(0);
+    m_scanId = 0;
+    m_completedDirectories.clear();
+    m_scope.clear();
+
+    ScanMonitor::instance()->finish();
 }
 
 void LocalFileScanner::stopScan()
 {
     if (m_scanActive)
     {
+        /* Make the workers leave their loop */
+        m_queue->abort();
         foreach(DirectoryWorker* worker, m_workers)
         {
             QThread *thread = worker->thread();
             if (thread != QCoreApplication::instance()->thread())
             {
                 thread->quit();
-                thread->wait(100);
+                /* The queue is shared: wait for the worker to leave it */
+                thread->wait();
                 delete thread;
                 delete worker;
             }
         }
         m_workers.clear();
+        delete m_queue;
+        m_queue = NULL;
+        m_knownFiles.clear();
         m_scanActive = false;
+        ScanMonitor::instance()->finish();
     }
+
+    /* Write what is still buffered before the thread is stopped */
+    m_ingestion->stop();
 }
 
 void LocalFileScanner::locationAdd(const QString &location)
@@ -148,35 +281,119 @@ QVector<QString> LocalFileScanner::getLocations() const
     return m_locations;
 }
 
-void LocalFileScanner::fileFound(QString filename, QString sha1)
+/* Limit the next run to the given directories and their subdirectories.
+ * Must be called when the scanner is stopped.
+ */
+void LocalFileScanner::setScanScope(const QStringList &directories)
+{
+    m_scope = directories;
+}
+
+/* Directories given to the workers: the locations, or the directories of
+ * the scope which are inside a location. A directory is dropped if one of
+ * its parents is already scanned.
+ */
+QStringList LocalFileScanner::computeScanRoots()
+{
+    QStringList roots;
+
+    if (m_scope.isEmpty())
+    {
+        return m_locations.toList();
+    }
+
+    /* Parents first */
+    QStringList directories = m_scope;
+    directories.sort();
+    foreach (QString directory, directories)
+    {
+        bool inLocation = false;
+        foreach (const QString &location, m_locations)
+        {
+            if (directory == location || directory.startsWith(location + "/"))
+            {
+                inLocation = true;
+                break;
+            }
+        }
+        if (!inLocation)
+        {
+            continue;
+        }
+        bool inRoot = false;
+        foreach (const QString &root, roots)
+        {
+            if (directory == root || directory.startsWith(root + "/"))
+            {
+                inRoot = true;
+                break;
+            }
+        }
+        if (!inRoot)
+        {
+            roots << directory;
+        }
+    }
+
+    if (roots.isEmpty())
+    {
+        /* Nothing known changed: check everything */
+        m_scope.clear();
+        return m_locations.toList();
+    }
+    return roots;
+}
+
+/* All the files of the directory have been found: checkpoint for a restart */
+void LocalFileScanner::directoryScanned(QString directory)
+{
+    m_ingestion->addCompletedDirectory(directory);
+}
+
+/* The file is the same as in the last scan: only mark it as still present */
+void LocalFileScanner::fileUnchanged(QString filename)
+{
+    m_ingestion->addUnchangedFile(filename, m_startTime);
+}
+
+void LocalFileScanner::fileFound(QString filename, QString sha1, EMSFileStat fileStat, QSharedPointer<FileProbe> probe)
 {
     EMSTrack track;
-    Database *db = Database::instance();
 
     track.type = TRACK_TYPE_DB;
     track.filename = filename;
     track.sha1 = sha1;
     track.lastscan = m_startTime;
+    track.fileStat = fileStat;
     QString extension = QFileInfo(filename).suffix().toLower();
     track.format = extension;
     track.id = 0;
 
-    /* 1) Search existing sha1 in the database */
-    unsigned long long trackID;
-    db->lock();
-    if(db->getTrackIdBySha1(&trackID, track.sha1))
-    {
-        /* Do nothing as we assume the metadata have correctly been seeked */
-        db->insertNewFilename(track.filename, trackID, m_startTime);
-        db->unlock();
-        return;
-    }
-    db->unlock();
+    /* The existence of the sha1 in the database is checked by batch */
+    m_ingestion->addFoundFile(track, probe);
+}
 
+/* This slot is called by the IngestionQueue for files with an unknown sha1.
+ * First phase: only the tags and stream info are read, the track is
+ * inserted in the database as soon as they are known.
+ */
+void LocalFileScanner::fileNeedUpdate(EMSTrack track)
+{
     /* Compute which plugins can be used to retrieve metadata */
     QStringList capabilities;
     /* Use extension name to find all plugins which can handle this format */
     capabilities << track.format;
+
+    ScanMonitor::instance()->fileNew();
+    emit trackNeedUpdate(track, capabilities);
+}
+
+/* This slot is called by the IngestionQueue when a new track is in the database.
+ * Second phase: the slow plugins complete it in background.
+ */
+void LocalFileScanner::trackStored(EMSTrack track)
+{
+    QStringList capabilities;
     /* Check if there is a file "discid" in the same directory and use it to retrieve metadata */
     capabilities << "discid";
     /* Use text retrieved from the metadata inside the file to perform online text lookup */
@@ -186,14 +403,12 @@ void LocalFileScanner::fileFound(QString filename, QString sha1)
     /* Look for a user cover file inside the directory */
     capabilities << "cover";
 
-    emit trackNeedUpdate(track, capabilities);
+    emit trackNeedEnrichment(track, capabilities);
 }
 
 /* This slot is called when new data are available for this track. */
 void LocalFileScanner::trackUpdated(EMSTrack track, bool complete)
 {
-    Database *db = Database::instance();
-
     /* First of all, check that the signal concern a track handled in this class */
     if (track.type != TRACK_TYPE_DB)
     {
@@ -212,29 +427,17 @@ void LocalFileScanner::trackUpdated(EMSTrack track, bool complete)
         track.name = QFileInfo(track.filename).baseName();
     }
 
-    /* Insert new track in database */
-    unsigned long long albumId;
-    QString directory = QFileInfo(track.filename).dir().path();
-    bool newAlbum = true;
-    db->lock(); /* Do not allow to execute other queries before inserting both album and track */
-    if (track.album.name.isEmpty())
+    if (track.id == 0)
     {
-        newAlbum = false;
-        track.album.id = 0; /* Unknown album */
+        /* Insert new track (and its album) in database with the next batch */
+        ScanMonitor::instance()->metadataDone();
+        m_ingestion->addCompleteTrack(track);
     }
-    else if(db->getAlbumIdByNameAndTrackFilename(&albumId, track.album.name, directory))
+    else
     {
-        track.album.id = albumId;
-        newAlbum = false;
+        /* Already in the database: update it with the enriched data */
+        m_ingestion->addEnrichedTrack(track);
     }
-
-    if (newAlbum)
-    {
-        db->insertNewAlbum(&(track.album));
-    }
-
-    db->insertNewTrack(&track);
-    db->unlock();
 }
 
 bool LocalFileScanner::isScanActive()
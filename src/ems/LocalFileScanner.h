@@ -5,6 +5,8 @@
 #include <QThread>
 #include "Database.h"
 #include "DirectoryWorker.h"
+#include "DirectoryQueue.h"
+#include "IngestionQueue.h"
 
 class LocalFileScanner : public QObject
 {
@@ -15,24 +17,41 @@ public:
 
     void locationAdd(const QString &location);
     QVector<QString> getLocations() const;
+    void setScanScope(const QStringList &directories);
 
     bool isScanActive();
 
 private:
     QVector<QString> m_locations;
+    QStringList m_scope; /* Directories to scan at the next run, all the locations if empty */
+    QStringList m_scanRoots; /* Directories scanned by the current run */
     QVector<DirectoryWorker*> m_workers;
+    DirectoryQueue *m_queue;
+    QHash<QString, EMSFileStat> m_knownFiles; /* stat() data of the last scan */
+    QSet<QString> m_completedDirectories; /* Already done by the resumed scan */
+    unsigned long long m_scanId; /* Checkpoints of this scan in the database */
+    IngestionQueue *m_ingestion;
+    int m_nbWorkers;
+    int m_rotationalWorkers; /* Per device budgets, see DirectoryQueue */
+    int m_otherWorkers;
     QString m_supportedFormat;
     bool m_scanActive;
     unsigned long long m_startTime;
     QTime m_measureTime;
 
     void scanEnd();
+    QStringList computeScanRoots();
 
 signals:
     void trackNeedUpdate(EMSTrack track, QStringList capabilities);
+    void trackNeedEnrichment(EMSTrack track, QStringList capabilities);
 
 public slots:
-    void fileFound(QString filename, QString sha1);
+    void fileFound(QString filename, QString sha1, EMSFileStat fileStat, QSharedPointer<FileProbe> probe);
+    void fileUnchanged(QString filename);
+    void directoryScanned(QString directory);
+    void fileNeedUpdate(EMSTrack track);
+    void trackStored(EMSTrack track);
     void trackUpdated(EMSTrack track, bool complete);
     void workerFinished(DirectoryWorker* worker);
     void startScan();
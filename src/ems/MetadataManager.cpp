@@ -1,5 +1,8 @@
 #include <QStringList>
+#include <QSettings>
+#include <QRunnable>
 
+#include "DefaultSettings.h"
 #include "MetadataManager.h"
 #include "FlacPlugin.h"
 #include "SndfilePlugin.h"
@@ -13,22 +16,79 @@
 
 MetadataManager* MetadataManager::_instance = 0;
 
+/* Run the plugins of one track in a thread of the pool */
+class MetadataManager::UpdateTask : public QRunnable
+{
+public:
+    UpdateTask(MetadataManager *manager, EMSTrack track, QVector<MetadataPlugin*> plugins) :
+        m_manager(manager), m_track(track), m_plugins(plugins) {}
+
+    void run()
+    {
+        m_manager->process(m_track, m_plugins);
+    }
+
+private:
+    MetadataManager *m_manager;
+    EMSTrack m_track;
+    QVector<MetadataPlugin*> m_plugins;
+};
+
 void MetadataManager::update(EMSTrack track, QStringList capabilities)
 {
-    QVector<MetadataPlugin*> plugins;
+    /* Deleted by the pool once done */
+    pool.start(new UpdateTask(this, track, getPluginsChain(capabilities)));
+}
+
+void MetadataManager::enrich(EMSTrack track, QStringList capabilities)
+{
+    QVector<MetadataPlugin*> chain = getPluginsChain(capabilities);
+    if (chain.isEmpty())
+    {
+        return;
+    }
+    enrichPool.start(new UpdateTask(this, track, chain));
+}
+
+/* Get the plugins to use for this list of capabilities.
+ * The order of this list is respected. The plugin are used consecutively.
+ * The scanner always asks for the same few lists, so the result is kept.
+ */
+QVector<MetadataPlugin*> MetadataManager::getPluginsChain(const QStringList &capabilities)
+{
+    QHash<QStringList, QVector<MetadataPlugin*> >::const_iterator it = chainsCache.constFind(capabilities);
+    if (it != chainsCache.constEnd())
+    {
+        return it.value();
+    }
 
-    /* The order of this list is respected. The plugin are used consecutively. */
+    QVector<MetadataPlugin*> chain;
     for (int i=0; i<capabilities.size(); i++)
     {
         QVector<MetadataPlugin*> availablePlugin = getAvailablePlugins(capabilities.at(i));
         for (int j=0; j<availablePlugin.size(); j++)
         {
-            if (!plugins.contains(availablePlugin.at(j)))
+            if (!chain.contains(availablePlugin.at(j)))
             {
-                plugins.append(availablePlugin.at(j));
+                chain.append(availablePlugin.at(j));
             }
         }
     }
+    chainsCache.insert(capabilities, chain);
+
+    return chain;
+}
+
+void MetadataManager::process(EMSTrack track, QVector<MetadataPlugin*> plugins)
+{
+    /* Reuse the blocks read for the sha1 if they are still available.
+     * Otherwise (probe is NULL), the plugins open the file themselves.
+     */
+    QSharedPointer<FileProbe> probe;
+    if (track.type == TRACK_TYPE_DB)
+    {
+        probe = FileProbeCache::instance()->take(track.filename);
+    }
 
     for (int i=0; i<plugins.size(); i++)
     {
@@ -39,10 +99,19 @@ void MetadataManager::update(EMSTrack track, QStringList capabilities)
             lastSignal = true;
         }
 
-        /* Synchronous update, this slot lives in the MetadataManager's thread */
-        plugin->lock();
-        plugin->update(&track);
-        plugin->unlock();
+        /* Synchronous update, in a thread of the pool.
+         * Non reentrant plugins handle one track at a time.
+         */
+        if (plugin->isReentrant())
+        {
+            plugin->update(&track, probe.data());
+        }
+        else
+        {
+            plugin->lock();
+            plugin->update(&track, probe.data());
+            plugin->unlock();
+        }
 
         if (!lastSignal)
         {
@@ -68,54 +137,51 @@ void MetadataManager::registerAllPlugins()
     plugins.append(new GracenotePlugin);
 #endif
 
-    mutex.unlock();
-}
-
-QVector<MetadataPlugin*> MetadataManager::getAvailablePlugins(QString capability)
-{
-    QVector<MetadataPlugin*> out;
-
-    mutex.lock();
+    /* Capabilities of the plugins don't change: build the dispatch table once */
+    dispatchTable.clear();
+    chainsCache.clear();
     foreach (MetadataPlugin* plugin, plugins)
     {
         foreach (QString capPlug, plugin->getCapabilities())
         {
-            if (capability == capPlug)
-            {
-                out.append(plugin);
-            }
+            dispatchTable[capPlug].append(plugin);
         }
     }
+    availableCapabilities = dispatchTable.keys();
+    availableCapabilities.sort();
+
     mutex.unlock();
+}
 
-    return out;
+QVector<MetadataPlugin*> MetadataManager::getAvailablePlugins(const QString &capability) const
+{
+    return dispatchTable.value(capability);
 }
 
 QStringList MetadataManager::getAvailableCapabilities()
 {
-    QStringList out;
-
-    mutex.lock();
-    foreach (MetadataPlugin* plugin, plugins)
-    {
-        foreach (QString capPlug, plugin->getCapabilities())
-        {
-            out.append(capPlug);
-        }
-    }
-    mutex.unlock();
-
-    out.sort();
-    out.removeDuplicates();
-    return out;
+    return availableCapabilities;
 }
 
 MetadataManager::MetadataManager(QObject *parent) : QObject(parent)
 {
+    QSettings settings;
+    int nbWorkers;
+    EMS_LOAD_SETTINGS(nbWorkers, "main/metadata_workers",
+                      EMS_METADATA_WORKERS, Int);
+    if (nbWorkers > 0)
+    {
+        pool.setMaxThreadCount(nbWorkers);
+    }
+    EMS_LOAD_SETTINGS(nbWorkers, "main/enrich_workers",
+                      EMS_ENRICH_WORKERS, Int);
+    enrichPool.setMaxThreadCount(qMax(nbWorkers, 1));
+
     qRegisterMetaType<EMSTrack>("EMSTrack");
 }
 
 MetadataManager::~MetadataManager()
 {
-
+    pool.waitForDone();
+    enrichPool.waitForDone();
 }
@@ -2,15 +2,22 @@
 #define METADATAMANAGER_H
 
 #include <QVector>
+#include <QHash>
 #include <QMutex>
 #include <QObject>
 #include <QString>
+#include <QThreadPool>
 #include "Data.h"
 #include "MetadataPlugin.h"
 
 /* This class is a plugin manager allowing other modules to get a working
  * plugin if there is one available plugin.
  * Enabling a plugin is made with qmake options.
+ * Tracks are processed concurrently by a pool of threads. The plugins of one
+ * track are still called one after the other, in the same thread, so the
+ * updated() signals of a track keep their order.
+ * Slow plugins (online lookups, fingerprints, ...) are run by enrich() in a
+ * second pool, so they never delay the tracks waiting for update().
  */
 class MetadataManager : public QObject
 {
@@ -21,7 +28,9 @@ class MetadataManager : public QObject
      * -----------------------------
      */
 public slots:
+    /* Must be called in the MetadataManager's thread (queued connection) */
     void update(EMSTrack track, QStringList capabilities);
+    void enrich(EMSTrack track, QStringList capabilities);
 
 signals:
     void updated(EMSTrack track, bool complete);
@@ -65,9 +74,28 @@ public:
 private:
     QVector<MetadataPlugin*> plugins;
     QMutex mutex;
+    QThreadPool pool;
+    QThreadPool enrichPool;
+
+    /* Built once by registerAllPlugins() and never modified after, so
+     * they are read without lock.
+     */
+    QHash<QString, QVector<MetadataPlugin*> > dispatchTable; /* capability -> plugins */
+    QStringList availableCapabilities;
+
+    /* Plugin chain of each list of capabilities already seen.
+     * Only used by the update() and enrich() slots (getPluginsChain), both
+     * run in the MetadataManager's thread: no lock is needed.
+     */
+    QHash<QStringList, QVector<MetadataPlugin*> > chainsCache;
 
     /* Internal methods */
-    QVector<MetadataPlugin*> getAvailablePlugins(QString capability);
+    QVector<MetadataPlugin*> getAvailablePlugins(const QString &capability) const;
+    QVector<MetadataPlugin*> getPluginsChain(const QStringList &capabilities);
+    void process(EMSTrack track, QVector<MetadataPlugin*> trackPlugins);
+
+    class UpdateTask;
+    friend class UpdateTask;
 
     /* Singleton pattern */
     static MetadataManager* _instance;
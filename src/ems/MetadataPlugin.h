@@ -5,6 +5,7 @@
 #include <QObject>
 #include <QStringList>
 #include "Data.h"
+#include "FileProbe.h"
 
 
 /* This class handle synchronous look up of data about an EMSTrack
@@ -13,21 +14,35 @@
  * must match that is defined in the plugin code.
  * For metadata specific to a file format, the capability is the name of the
  * extention. For example : "flac" or "dsf".
+ * A plugin is called by the threads of the MetadataManager pool. If it only
+ * works on the given track (eg. reads its file), it can set "reentrant" to
+ * true in its constructor to be called concurrently. Otherwise, the calls
+ * are serialized with lock()/unlock().
  */
 class MetadataPlugin : public QObject
 {
     Q_OBJECT
 
 public:
+    MetadataPlugin() : reentrant(false) {}
+
     virtual bool update(EMSTrack *track) = 0;
 
+    /* Same as update(track), with the first and last blocks of the file
+     * already in memory (probe can be NULL). Plugins able to parse their
+     * headers from these blocks override it, the others open the file.
+     */
+    virtual bool update(EMSTrack *track, const FileProbe *probe) { Q_UNUSED(probe); return update(track); }
+
     QStringList getCapabilities() { QStringList out; mutex.lock(); out = capabilities; mutex.unlock(); return out; }
     void lock() { mutex.lock(); }
     void unlock() { mutex.unlock(); }
+    bool isReentrant() const { return reentrant; }
 
 protected:
     QMutex mutex;
     QStringList capabilities;
+    bool reentrant;
 };
 
 #endif // METADATAPLUGIN_H
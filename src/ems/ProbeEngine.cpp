@@ -0,0 +1,434 @@
+#include <QDebug>
+#include <QSettings>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QPair>
+#include <QStack>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef EMS_FEATURE_IOURING
+#include <liburing.h>
+#endif
+
+#include "DefaultSettings.h"
+#include "ProbeEngine.h"
+#include "ScanThrottle.h"
+
+/* Probes read by the pool, given back to the thread of the engine */
+struct ProbeResults
+{
+    QMutex mutex;
+    QWaitCondition available;
+    QQueue<QPair<int, QSharedPointer<FileProbe> > > probes;
+};
+
+class ProbeTask : public QRunnable
+{
+public:
+    ProbeTask(ProbeResults *results, int index, const QString &filename, bool dropCache) :
+        m_results(results),
+        m_index(index),
+        m_filename(filename),
+        m_dropCache(dropCache)
+    {
+    }
+
+    void run()
+    {
+        QSharedPointer<FileProbe> probe(new FileProbe);
+
+        /* Same priority as the scan worker in background mode */
+        ScanThrottle::instance()->setThreadPriority();
+        if (!probe->open(m_filename, m_dropCache))
+        {
+            probe.clear();
+        }
+
+        m_results->mutex.lock();
+        m_results->probes.enqueue(qMakePair(m_index, probe));
+        m_results->available.wakeOne();
+        m_results->mutex.unlock();
+    }
+
+private:
+    ProbeResults *m_results;
+    int m_index;
+    QString m_filename;
+    bool m_dropCache;
+};
+
+/* Pool of the engines of all the scan workers */
+static QThreadPool *probePool(int maxThreads)
+{
+    static QMutex mutex;
+    static QThreadPool *pool = NULL;
+
+    mutex.lock();
+    if (!pool)
+    {
+        pool = new QThreadPool;
+        pool->setMaxThreadCount(maxThreads);
+    }
+    mutex.unlock();
+
+    return pool;
+}
+
+ProbeEngine::ProbeEngine(bool dropCache) :
+    m_dropCache(dropCache),
+    m_ring(NULL),
+    m_ringFailed(false)
+{
+    QSettings settings;
+    EMS_LOAD_SETTINGS(m_queueDepth, "main/probe_queue_depth",
+                      EMS_PROBE_QUEUE_DEPTH, Int);
+    if (m_queueDepth < 1)
+    {
+        m_queueDepth = 1;
+    }
+
+#ifdef EMS_FEATURE_IOURING
+    if (m_queueDepth > 1)
+    {
+        /* Two reads per file */
+        m_ring = new struct io_uring;
+        int ret = io_uring_queue_init(2*m_queueDepth, m_ring, 0);
+        if (ret < 0)
+        {
+            qDebug() << "ProbeEngine: io_uring not available (" << strerror(-ret) << "), use a thread pool";
+            delete m_ring;
+            m_ring = NULL;
+        }
+    }
+#endif
+}
+
+ProbeEngine::~ProbeEngine()
+{
+#ifdef EMS_FEATURE_IOURING
+    if (m_ring)
+    {
+        io_uring_queue_exit(m_ring);
+        delete m_ring;
+    }
+#endif
+}
+
+void ProbeEngine::probe(const QStringList &filenames, bool rotational, Callback callback)
+{
+    bool parallel = !rotational && m_queueDepth > 1 && filenames.size() > 1;
+
+    if (parallel && m_ring && !m_ringFailed)
+    {
+        probeWithRing(filenames, callback);
+    }
+    else if (parallel)
+    {
+        probeWithPool(filenames, callback);
+    }
+    else
+    {
+        for (int i=0; i<filenames.size(); i++)
+        {
+            QSharedPointer<FileProbe> probe(new FileProbe);
+            if (!probe->open(filenames.at(i), m_dropCache))
+            {
+                probe.clear();
+            }
+            if (!callback(i, probe))
+            {
+                break;
+            }
+        }
+    }
+}
+
+void ProbeEngine::probeWithPool(const QStringList &filenames, Callback callback)
+{
+    ProbeResults results;
+    int next = 0;
+    int inFlight = 0;
+    bool stopped = false;
+
+    results.mutex.lock();
+    while ((!stopped && next < filenames.size()) || inFlight > 0)
+    {
+        /* 1) Keep queueDepth files in flight */
+        while (!stopped && next < filenames.size() && inFlight < m_queueDepth)
+        {
+            probePool(m_queueDepth)->start(new ProbeTask(&results, next, filenames.at(next), m_dropCache));
+            next++;
+            inFlight++;
+        }
+
+        /* 2) Give the next probe, without blocking the pool */
+        while (results.probes.isEmpty())
+        {
+            results.available.wait(&results.mutex);
+        }
+        QPair<int, QSharedPointer<FileProbe> > result = results.probes.dequeue();
+        inFlight--;
+
+        if (!stopped)
+        {
+            results.mutex.unlock();
+            stopped = !callback(result.first, result.second);
+            results.mutex.lock();
+        }
+    }
+    results.mutex.unlock();
+}
+
+#ifdef EMS_FEATURE_IOURING
+
+void ProbeEngine::probeWithRing(const QStringList &filenames, Callback callback)
+{
+    QVector<RingRequest> requests(m_queueDepth);
+    QStack<int> freeRequests;
+    int next = 0;
+    bool stopped = false;
+
+    for (int i=m_queueDepth-1; i>=0; i--)
+    {
+        freeRequests.push(i);
+    }
+
+    while ((!stopped && next < filenames.size()) || freeRequests.size() < m_queueDepth)
+    {
+        /* 1) Keep queueDepth files in flight */
+        while (!stopped && next < filenames.size() && !freeRequests.isEmpty())
+        {
+            int requestId = freeRequests.top();
+            RingRequest *request = &requests[requestId];
+
+            request->index = next++;
+            if (queueReads(request, requestId, filenames.at(request->index)))
+            {
+                freeRequests.pop();
+            }
+            else
+            {
+                /* Nothing to wait for: error, or empty file */
+                stopped = !callback(request->index, request->probe);
+                request->probe.clear();
+            }
+        }
+        io_uring_submit(m_ring);
+
+        if (freeRequests.size() == m_queueDepth)
+        {
+            continue;
+        }
+
+        /* 2) Wait for a read, then handle all the completed ones */
+        struct io_uring_cqe *cqe;
+        int ret = io_uring_wait_cqe(m_ring, &cqe);
+        if (ret == -EINTR)
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            qCritical() << "ProbeEngine: error waiting for the reads (" << strerror(-ret) << "), use a thread pool";
+            m_ringFailed = true;
+
+            /* The files in flight and the next ones are read again by the pool */
+            QVector<bool> isFree(m_queueDepth, false);
+            foreach (int requestId, freeRequests)
+            {
+                isFree[requestId] = true;
+            }
+            QStringList others;
+            QVector<int> indexes;
+            for (int i=0; i<m_queueDepth; i++)
+            {
+                if (!isFree.at(i))
+                {
+                    ::close(requests[i].fd);
+                    m_abandonedProbes.append(requests[i].probe);
+                    others << filenames.at(requests[i].index);
+                    indexes << requests[i].index;
+                }
+            }
+            while (!stopped && next < filenames.size())
+            {
+                others << filenames.at(next);
+                indexes << next++;
+            }
+            if (!stopped)
+            {
+                probeWithPool(others, [&](int index, QSharedPointer<FileProbe> probe) -> bool
+                {
+                    return callback(indexes.at(index), probe);
+                });
+            }
+            return;
+        }
+
+        do
+        {
+            unsigned long long userData = cqe->user_data;
+            int requestId = userData >> 1;
+            int block = userData & 1;
+            int res = cqe->res;
+            RingRequest *request = &requests[requestId];
+            FileProbe *probe = request->probe.data();
+            qint64 length = block ? probe->m_tailSize : probe->m_headSize;
+            bool completed = true;
+            io_uring_cqe_seen(m_ring, cqe);
+
+            if (res <= 0)
+            {
+                /* Error, or end of the file: it is shorter than its stat() */
+                request->failed = true;
+            }
+            else if (request->done[block] + res < length)
+            {
+                /* Short read, legal on the network file systems: read the rest */
+                request->done[block] += res;
+                char *buffer = block ? probe->m_tailBuffer.data() : probe->m_headBuffer.data();
+                qint64 offset = block ? probe->m_fileSize - probe->m_tailSize : 0;
+                completed = !queueRead(request->fd, buffer + request->done[block], length - request->done[block],
+                                       offset + request->done[block], userData);
+                if (completed)
+                {
+                    request->failed = true;
+                }
+            }
+
+            if (completed && --request->pending == 0)
+            {
+                closeRequest(request);
+                if (!stopped)
+                {
+                    stopped = !callback(request->index, request->probe);
+                }
+                request->probe.clear();
+                freeRequests.push(requestId);
+            }
+        } while (io_uring_peek_cqe(m_ring, &cqe) == 0);
+    }
+}
+
+/* Open the file and queue the reads of its blocks.
+ * Return false if there is nothing to wait for: request->probe is then
+ * either null (error) or the probe of an empty file.
+ */
+bool ProbeEngine::queueReads(RingRequest *request, int requestId, const QString &filename)
+{
+    struct stat st;
+
+    request->probe = QSharedPointer<FileProbe>(new FileProbe);
+    request->pending = 0;
+    request->done[0] = 0;
+    request->done[1] = 0;
+    request->failed = false;
+
+    request->fd = ::open(filename.toUtf8().data(), O_RDONLY);
+    if (request->fd < 0)
+    {
+        qDebug() << "Error opening " << filename;
+        request->probe.clear();
+        return false;
+    }
+
+    if (fstat(request->fd, &st) != 0)
+    {
+        qDebug() << "Error getting status of " << filename;
+        ::close(request->fd);
+        request->probe.clear();
+        return false;
+    }
+
+    FileProbe *probe = request->probe.data();
+    probe->allocateBuffers(filename, st.st_size);
+    if (st.st_size == 0)
+    {
+        ::close(request->fd);
+        return false;
+    }
+
+    if (m_dropCache)
+    {
+        posix_fadvise(request->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    /* A small file is read only once : head and tail are the same */
+    if (!queueRead(request->fd, probe->m_headBuffer.data(), probe->m_headSize, 0, requestId << 1))
+    {
+        qDebug() << "Error queuing the reads of " << filename;
+        ::close(request->fd);
+        request->probe.clear();
+        return false;
+    }
+    request->pending++;
+    if (probe->m_fileSize > (unsigned long long)FileProbe::blockSize)
+    {
+        if (queueRead(request->fd, probe->m_tailBuffer.data(), probe->m_tailSize,
+                      probe->m_fileSize - probe->m_tailSize, (requestId << 1) | 1))
+        {
+            request->pending++;
+        }
+        else
+        {
+            /* The head is in flight: the request fails when it completes */
+            request->failed = true;
+        }
+    }
+
+    return true;
+}
+
+/* Return false if the submission queue is still full after a submit */
+bool ProbeEngine::queueRead(int fd, char *buffer, qint64 length, qint64 offset, unsigned long long userData)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(m_ring);
+    if (!sqe)
+    {
+        /* Submission queue full */
+        io_uring_submit(m_ring);
+        sqe = io_uring_get_sqe(m_ring);
+        if (!sqe)
+        {
+            return false;
+        }
+    }
+    io_uring_prep_read(sqe, fd, buffer, length, offset);
+    sqe->user_data = userData;
+    return true;
+}
+
+void ProbeEngine::closeRequest(RingRequest *request)
+{
+    if (m_dropCache)
+    {
+        /* The blocks are copied: free their pages, they would evict the file being played */
+        posix_fadvise(request->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    ::close(request->fd);
+
+    if (request->failed)
+    {
+        qDebug() << "Error reading " << request->probe->filename();
+        request->probe.clear();
+    }
+    else
+    {
+        request->probe->attachBuffers();
+    }
+}
+
+#else
+
+void ProbeEngine::probeWithRing(const QStringList &filenames, Callback callback)
+{
+    probeWithPool(filenames, callback);
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef PROBEENGINE_H
+#define PROBEENGINE_H
+
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QSharedPointer>
+#include <functional>
+
+#include "FileProbe.h"
+
+struct io_uring;
+
+/* Read the head and tail blocks of many files at the same time.
+ * On network file systems, each read costs a round trip: reading the files
+ * one after the other leaves the link idle most of the time. The engine
+ * keeps up to main/probe_queue_depth files in flight:
+ *  - with io_uring (built with EMS_FEATURE_IOURING=yes), the reads of all
+ *    the files are queued in the ring of the calling thread. The files are
+ *    still opened with a blocking open(). A short read (network file
+ *    systems) is queued again for the rest of the block. If the ring fails,
+ *    the engine goes on with the pool.
+ *  - otherwise, or if the kernel refuses the ring, each file is read by a
+ *    thread of a pool (FileProbe::open reads the blocks in the thread, the
+ *    round trips overlap). The pool is shared by the engines
+ *    of all the scan workers, with main/probe_queue_depth threads at most.
+ * A depth of 1 reads the files one after the other in the calling thread,
+ * as the files of a spinning disk (see DirectoryQueue::isRotational).
+ * One engine must be used by only one thread.
+ */
+class ProbeEngine
+{
+public:
+    /* Called in the thread of probe(), in the order of completion.
+     * probe is null if the file can't be read.
+     * Return false to stop: the reads in flight are waited for, but not given.
+     */
+    typedef std::function<bool (int index, QSharedPointer<FileProbe> probe)> Callback;
+
+    /* If dropCache is true, the files are removed from the page cache (background scan) */
+    explicit ProbeEngine(bool dropCache = false);
+    ~ProbeEngine();
+
+    /* rotational: the files are on a spinning disk, read them one by one */
+    void probe(const QStringList &filenames, bool rotational, Callback callback);
+
+private:
+    struct RingRequest
+    {
+        int index;
+        int fd;
+        int pending; /* Reads not completed yet */
+        qint64 done[2]; /* Bytes already read in the head and tail blocks */
+        bool failed;
+        QSharedPointer<FileProbe> probe;
+    };
+
+    int m_queueDepth;
+    bool m_dropCache;
+    struct io_uring *m_ring;
+    bool m_ringFailed;
+    /* Probes of the reads abandoned in a failed ring: the kernel may
+     * still write their buffers until the ring is destroyed.
+     */
+    QList<QSharedPointer<FileProbe> > m_abandonedProbes;
+
+    void probeWithRing(const QStringList &filenames, Callback callback);
+    void probeWithPool(const QStringList &filenames, Callback callback);
+    bool queueReads(RingRequest *request, int requestId, const QString &filename);
+    bool queueRead(int fd, char *buffer, qint64 length, qint64 offset, unsigned long long userData);
+    void closeRequest(RingRequest *request);
+
+    ProbeEngine(const ProbeEngine &);
+    ProbeEngine& operator=(const ProbeEngine &);
+};
+
+#endif // PROBEENGINE_H
@@ -0,0 +1,152 @@
+#include <math.h>
+
+#include "Resampler.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Taps per phase for a decimation by 1, more for a bigger ratio */
+#define RESAMPLER_BASE_TAPS 32
+/* Passband, in fraction of the Nyquist frequency of the lowest rate */
+#define RESAMPLER_ROLLOFF 0.91
+
+static int gcd(int a, int b)
+{
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+Resampler::Resampler(int inRate, int outRate, int channels) :
+    m_channels(channels),
+    m_phase(0)
+{
+    int divisor = gcd(inRate, outRate);
+    m_up = outRate / divisor;
+    m_down = inRate / divisor;
+
+    int ratio = (m_down + m_up - 1) / m_up;
+    m_taps = RESAMPLER_BASE_TAPS * ratio;
+
+    /* Prototype low-pass filter at the upsampled rate, Blackman window */
+    int length = m_taps * m_up;
+    double cutoff = RESAMPLER_ROLLOFF * 0.5 / qMax(m_up, m_down);
+    double center = (length - 1) / 2.0;
+    QVector<double> prototype(length);
+    for (int i=0; i<length; i++)
+    {
+        double x = i - center;
+        double sinc = (x == 0.0) ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * cos(2.0 * M_PI * i / (length - 1)) +
+                        0.08 * cos(4.0 * M_PI * i / (length - 1));
+        prototype[i] = sinc * window * m_up;
+    }
+
+    /* Phase p uses the coefficients p, p+up, p+2*up... in the reverse order,
+     * to be multiplied with the input samples in memory order
+     */
+    m_coefs.resize(length);
+    for (int p=0; p<m_up; p++)
+    {
+        for (int k=0; k<m_taps; k++)
+        {
+            m_coefs[p*m_taps + (m_taps - 1 - k)] = prototype.at(k*m_up + p);
+        }
+    }
+
+    /* The filter starts with a silence */
+    m_history.resize(m_channels);
+    for (int c=0; c<m_channels; c++)
+    {
+        m_history[c].fill(0.0f, m_taps - 1);
+    }
+    m_next = m_taps - 1;
+}
+
+void Resampler::process(const float *in, int nbFrames, QVector<float> *out)
+{
+    /* 1) Planar copy of the input, after the history */
+    int size = m_history.at(0).size();
+    for (int c=0; c<m_channels; c++)
+    {
+        QVector<float> &history = m_history[c];
+        history.resize(size + nbFrames);
+        float *dst = history.data() + size;
+        for (int i=0; i<nbFrames; i++)
+        {
+            dst[i] = in[i*m_channels + c];
+        }
+    }
+    size += nbFrames;
+
+    /* 2) Output samples, as long as their input is available */
+    while (m_next < size)
+    {
+        const float *coefs = m_coefs.constData() + m_phase * m_taps;
+        for (int c=0; c<m_channels; c++)
+        {
+            out->append(dotProduct(coefs, m_history.at(c).constData() + m_next - m_taps + 1, m_taps));
+        }
+        m_phase += m_down;
+        m_next += m_phase / m_up;
+        m_phase %= m_up;
+    }
+
+    /* 3) Keep only the input of the next output samples */
+    int drop = qMin(m_next - (m_taps - 1), size);
+    if (drop > 0)
+    {
+        for (int c=0; c<m_channels; c++)
+        {
+            m_history[c].remove(0, drop);
+        }
+        m_next -= drop;
+    }
+}
+
+void Resampler::flush(QVector<float> *out)
+{
+    QVector<float> silence(m_taps * m_channels, 0.0f);
+    process(silence.constData(), m_taps / 2, out);
+}
+
+float Resampler::dotProduct(const float *a, const float *b, int length)
+{
+#if defined(__SSE__)
+    __m128 sum = _mm_setzero_ps();
+    for (int i=0; i<length; i+=4)
+    {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float partial[4];
+    _mm_storeu_ps(partial, sum);
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#elif defined(__ARM_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int i=0; i<length; i+=4)
+    {
+        sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float partial[4];
+    vst1q_f32(partial, sum);
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#else
+    /* Four independent sums, as the vector versions */
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i=0; i<length; i+=4)
+    {
+        sum[0] += a[i] * b[i];
+        sum[1] += a[i+1] * b[i+1];
+        sum[2] += a[i+2] * b[i+2];
+        sum[3] += a[i+3] * b[i+3];
+    }
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+#endif
+}
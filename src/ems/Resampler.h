@@ -0,0 +1,37 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QVector>
+
+/* Sample rate converter for the transcoded streams (TranscodeStream).
+ * Polyphase FIR: the rate is multiplied by up/down (reduced by their gcd),
+ * each output sample is the dot product of one phase of a windowed sinc
+ * with the last input samples. The dot product uses SSE or NEON when the
+ * target has it.
+ * The samples are interleaved floats, as given by libsndfile.
+ */
+class Resampler
+{
+public:
+    Resampler(int inRate, int outRate, int channels);
+
+    /* Convert nbFrames frames, the output frames are appended to out */
+    void process(const float *in, int nbFrames, QVector<float> *out);
+
+    /* End of the input: give the samples still in the filter */
+    void flush(QVector<float> *out);
+
+private:
+    int m_up;
+    int m_down;
+    int m_channels;
+    int m_taps;       /* Per phase, multiple of 4 */
+    int m_phase;      /* Phase of the next output sample */
+    int m_next;       /* Index in m_history of the last input of the next output sample */
+    QVector<float> m_coefs;                /* m_up phases of m_taps, reversed */
+    QVector<QVector<float> > m_history;    /* One buffer per channel */
+
+    static float dotProduct(const float *a, const float *b, int length);
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,195 @@
+#include <QDebug>
+#include <QSettings>
+
+#include "DefaultSettings.h"
+#include "ScanMonitor.h"
+
+ScanMonitor* ScanMonitor::_instance = 0;
+
+ScanMonitor::ScanMonitor()
+{
+    QSettings settings;
+    EMS_LOAD_SETTINGS(m_period, "main/scan_progress_period",
+                      EMS_SCAN_PROGRESS_PERIOD, Int);
+
+    qRegisterMetaType<EMSScanProgress>("EMSScanProgress");
+
+    m_phase = "idle";
+    m_expectedFiles = 0;
+    m_filesSeen = 0;
+    m_filesNew = 0;
+    m_metadataDone = 0;
+    m_bytesRead = 0;
+    m_phaseStart = 0;
+    m_metadataPhaseStart = 0;
+    m_scanTime.start();
+    m_lastEmit.start();
+}
+
+void ScanMonitor::start(unsigned long long expectedFiles)
+{
+    m_mutex.lock();
+    m_phase = "walk";
+    m_expectedFiles = expectedFiles;
+    m_filesSeen = 0;
+    m_filesNew = 0;
+    m_metadataDone = 0;
+    m_bytesRead = 0;
+    m_phaseStart = 0;
+    m_metadataPhaseStart = 0;
+    m_scanTime.restart();
+    m_mutex.unlock();
+
+    notify(true);
+}
+
+void ScanMonitor::setPhase(const QString &phase)
+{
+    m_mutex.lock();
+    bool changed = (m_phase != phase);
+    if (changed)
+    {
+        m_phase = phase;
+        m_phaseStart = m_scanTime.elapsed();
+        m_metadataPhaseStart = m_metadataDone;
+    }
+    m_mutex.unlock();
+
+    if (changed)
+    {
+        notify(true);
+    }
+}
+
+void ScanMonitor::fileSeen()
+{
+    m_mutex.lock();
+    m_filesSeen++;
+    m_mutex.unlock();
+
+    notify(false);
+}
+
+/* A file was opened to compute its sha1 */
+void ScanMonitor::fileRead(qint64 bytes)
+{
+    m_mutex.lock();
+    m_bytesRead += bytes;
+    bool changed = (m_phase == "walk");
+    if (changed)
+    {
+        m_phase = "hash";
+        m_phaseStart = m_scanTime.elapsed();
+    }
+    m_mutex.unlock();
+
+    notify(changed);
+}
+
+/* The sha1 of the file is unknown: the file is given to the metadata plugins */
+void ScanMonitor::fileNew()
+{
+    m_mutex.lock();
+    m_filesNew++;
+    m_mutex.unlock();
+
+    notify(false);
+}
+
+void ScanMonitor::metadataDone()
+{
+    m_mutex.lock();
+    m_metadataDone++;
+    bool finished = (m_phase == "metadata" && m_metadataDone >= m_filesNew);
+    m_mutex.unlock();
+
+    if (finished)
+    {
+        setPhase("idle");
+    }
+    else
+    {
+        notify(false);
+    }
+}
+
+/* End of the scan of the directories. The metadata of the new files may
+ * still be retrieved by the MetadataManager.
+ */
+void ScanMonitor::finish()
+{
+    m_mutex.lock();
+    bool pending = (m_metadataDone < m_filesNew);
+    m_mutex.unlock();
+
+    setPhase(pending ? "metadata" : "idle");
+}
+
+EMSScanProgress ScanMonitor::progress()
+{
+    EMSScanProgress progress;
+
+    m_mutex.lock();
+    progress = computeProgress();
+    m_mutex.unlock();
+
+    return progress;
+}
+
+/* Must be called with m_mutex locked */
+EMSScanProgress ScanMonitor::computeProgress()
+{
+    EMSScanProgress progress;
+    qint64 elapsed = m_scanTime.elapsed();
+
+    progress.phase = m_phase;
+    progress.files_seen = m_filesSeen;
+    progress.files_new = m_filesNew;
+    if (elapsed > 0)
+    {
+        progress.files_per_second = (m_filesSeen * 1000.0) / elapsed;
+        progress.mb_per_second = (m_bytesRead * 1000.0) / (elapsed * 1024.0 * 1024.0);
+    }
+
+    /* The ETA is estimated with the number of files of the last scan while
+     * the directories are listed, then with the analyzed files.
+     */
+    if ((m_phase == "walk" || m_phase == "hash") &&
+        progress.files_per_second > 0 && m_expectedFiles > m_filesSeen)
+    {
+        progress.eta = (m_expectedFiles - m_filesSeen) / progress.files_per_second;
+    }
+    else if (m_phase == "metadata")
+    {
+        qint64 phaseElapsed = elapsed - m_phaseStart;
+        unsigned long long done = m_metadataDone - m_metadataPhaseStart;
+        if (phaseElapsed > 0 && done > 0 && m_filesNew > m_metadataDone)
+        {
+            double rate = (done * 1000.0) / phaseElapsed;
+            progress.eta = (m_filesNew - m_metadataDone) / rate;
+        }
+    }
+    else if (m_phase == "idle")
+    {
+        progress.eta = 0;
+    }
+
+    return progress;
+}
+
+void ScanMonitor::notify(bool force)
+{
+    EMSScanProgress progress;
+
+    m_mutex.lock();
+    if (!force && m_lastEmit.elapsed() < m_period)
+    {
+        m_mutex.unlock();
+        return;
+    }
+    m_lastEmit.restart();
+    progress = computeProgress();
+    m_mutex.unlock();
+
+    emit scanProgressChanged(progress);
+}
@@ -0,0 +1,76 @@
+#ifndef SCANMONITOR_H
+#define SCANMONITOR_H
+
+#include <QObject>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "Data.h"
+
+/* Progress of the local file scanner.
+ * The counters are updated by the DirectoryWorkers, the IngestionQueue and
+ * the LocalFileScanner, from their own threads. The signal
+ * scanProgressChanged() is emitted at most once per main/scan_progress_period
+ * ms, and each time the phase changes.
+ */
+class ScanMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    /* Thread safe API */
+    void start(unsigned long long expectedFiles);
+    void setPhase(const QString &phase);
+    void fileSeen();
+    void fileRead(qint64 bytes);
+    void fileNew();
+    void metadataDone();
+    void finish();
+
+    EMSScanProgress progress();
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static ScanMonitor* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new ScanMonitor;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+private:
+    QMutex m_mutex;
+    QElapsedTimer m_scanTime;
+    QElapsedTimer m_lastEmit;
+    int m_period;
+
+    QString m_phase;
+    unsigned long long m_expectedFiles; /* Number of files of the last scan */
+    unsigned long long m_filesSeen;
+    unsigned long long m_filesNew;
+    unsigned long long m_metadataDone;
+    qint64 m_bytesRead;
+    qint64 m_phaseStart; /* ms since the start of the scan */
+    unsigned long long m_metadataPhaseStart; /* metadataDone at phase start */
+
+    EMSScanProgress computeProgress();
+    void notify(bool force);
+
+    static ScanMonitor* _instance;
+    ScanMonitor();
+    ScanMonitor(const ScanMonitor &);
+    ScanMonitor& operator=(const ScanMonitor &);
+
+signals:
+    void scanProgressChanged(EMSScanProgress progress);
+};
+
+#endif // SCANMONITOR_H
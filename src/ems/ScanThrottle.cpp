@@ -0,0 +1,103 @@
+#include <QDebug>
+#include <QSettings>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#endif
+
+#include "DefaultSettings.h"
+#include "Player.h"
+#include "ScanThrottle.h"
+
+#ifdef Q_OS_LINUX
+/* See linux/ioprio.h, not exported by the libc */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_PRIO_VALUE(ioclass, data) (((ioclass) << IOPRIO_CLASS_SHIFT) | (data))
+#endif
+
+/* Niceness of the scan threads in background mode */
+#define SCAN_BACKGROUND_NICE 19
+
+ScanThrottle* ScanThrottle::_instance = 0;
+
+ScanThrottle::ScanThrottle()
+{
+    QSettings settings;
+    int maxBandwidth;
+    EMS_LOAD_SETTINGS(m_background, "main/scan_background",
+                      EMS_SCAN_BACKGROUND, Bool);
+    EMS_LOAD_SETTINGS(maxBandwidth, "main/scan_play_bandwidth",
+                      EMS_SCAN_PLAY_BANDWIDTH, Int);
+    m_maxBandwidth = (qint64)maxBandwidth * 1024;
+    m_windowBytes = 0;
+
+    /* The status is only written by the signal handler: no event loop needed */
+    m_playing = (Player::instance()->getStatus().state == STATUS_PLAY);
+    connect(Player::instance(), &Player::statusChanged,
+            this, &ScanThrottle::playerStatusChanged, Qt::DirectConnection);
+}
+
+bool ScanThrottle::isBackground() const
+{
+    return m_background;
+}
+
+void ScanThrottle::playerStatusChanged(EMSPlayerStatus status)
+{
+    m_playing = (status.state == STATUS_PLAY);
+}
+
+void ScanThrottle::setThreadPriority()
+{
+    if (!m_background)
+    {
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    /* Both apply to the calling thread only */
+    pid_t tid = syscall(SYS_gettid);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0)
+    {
+        qDebug() << "ScanThrottle: unable to set the idle I/O priority";
+    }
+    if (setpriority(PRIO_PROCESS, tid, SCAN_BACKGROUND_NICE) != 0)
+    {
+        qDebug() << "ScanThrottle: unable to lower the CPU priority";
+    }
+#else
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+#endif
+}
+
+/* Token bucket shared by all the scan threads: the data read since the start
+ * of the window must not be read faster than m_maxBandwidth.
+ */
+void ScanThrottle::throttle(qint64 bytes)
+{
+    if (!m_background || m_maxBandwidth <= 0 || !m_playing.load())
+    {
+        return;
+    }
+
+    qint64 wait;
+    m_mutex.lock();
+    if (!m_window.isValid() || m_window.elapsed() > 1000)
+    {
+        m_window.start();
+        m_windowBytes = 0;
+    }
+    m_windowBytes += bytes;
+    wait = (m_windowBytes * 1000) / m_maxBandwidth - m_window.elapsed();
+    m_mutex.unlock();
+
+    if (wait > 0)
+    {
+        QThread::msleep(wait);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef SCANTHROTTLE_H
+#define SCANTHROTTLE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "Data.h"
+
+/* Background mode of the scanner (main/scan_background).
+ * The scan threads get the idle I/O priority and a lower CPU priority, the
+ * files are read without keeping them in the page cache and, while the
+ * Player is playing, the read bandwidth of all the scan threads together is
+ * limited to main/scan_play_bandwidth KiB/s. The scan goes back to full
+ * speed as soon as the playback is stopped or paused.
+ */
+class ScanThrottle : public QObject
+{
+    Q_OBJECT
+public:
+    bool isBackground() const;
+
+    /* Must be called by each thread which reads the files, for itself: not
+     * by the scanner thread, which holds the database lock
+     */
+    void setThreadPriority();
+
+    /* Thread safe: block the caller if too much data were read */
+    void throttle(qint64 bytes);
+
+    /* Signleton pattern
+     * See: http://www.qtcentre.org/wiki/index.php?title=Singleton_pattern
+     */
+    static ScanThrottle* instance()
+    {
+        static QMutex mutexinst;
+        if (!_instance)
+        {
+            mutexinst.lock();
+
+            if (!_instance)
+                _instance = new ScanThrottle;
+
+            mutexinst.unlock();
+        }
+        return _instance;
+    }
+
+private:
+    bool m_background;
+    qint64 m_maxBandwidth; /* In bytes per second, 0 for no limit */
+    QAtomicInt m_playing;
+
+    QMutex m_mutex;
+    QElapsedTimer m_window;
+    qint64 m_windowBytes;
+
+    static ScanThrottle* _instance;
+    ScanThrottle();
+    ScanThrottle(const ScanThrottle &);
+    ScanThrottle& operator=(const ScanThrottle &);
+
+private slots:
+    void playerStatusChanged(EMSPlayerStatus status);
+};
+
+#endif // SCANTHROTTLE_H
@@ -10,6 +10,9 @@ SndfilePlugin::SndfilePlugin()
     capabilities << "rf64";
     // Libsndfile can handle much more formats...
     // See: http://www.mega-nerd.com/libsndfile
+
+    /* One SNDFILE handle per call */
+    reentrant = true;
 }
 
 SndfilePlugin::~SndfilePlugin()
@@ -64,6 +64,9 @@ TagLibPlugin::TagLibPlugin()
     capabilities << "aiff";
     capabilities << "wav";
     capabilities << "ogg";
+
+    /* One TagLib::FileRef per call, nothing is shared */
+    reentrant = true;
 }
 
 TagLibPlugin::~TagLibPlugin()
@@ -0,0 +1,188 @@
+#include <QDebug>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
+
+#include "TrackStream.h"
+
+/* Sent at most in one go, to share the thread between the streams */
+static const qint64 chunkSize = 256*1024;
+
+TrackStream::TrackStream(QTcpSocket *socket, int fd, qint64 offset, qint64 length, int bandwidth, QObject *parent) :
+    QObject(parent),
+    m_socket(socket),
+    m_fd(fd),
+    m_offset(offset),
+    m_remaining(length),
+    m_bandwidth(bandwidth),
+    m_done(false),
+    m_notifier(NULL),
+    m_sent(0)
+{
+#ifdef Q_OS_LINUX
+    m_zeroCopy = true;
+    m_notifier = new QSocketNotifier(m_socket->socketDescriptor(), QSocketNotifier::Write, this);
+    m_notifier->setEnabled(false);
+    connect(m_notifier, &QSocketNotifier::activated, this, &TrackStream::sendData);
+#else
+    m_zeroCopy = false;
+#endif
+
+    m_throttleTimer.setSingleShot(true);
+    connect(&m_throttleTimer, &QTimer::timeout, this, &TrackStream::sendData);
+
+    /* Queued: the socket must have disabled its own write notifier when
+     * its buffer is empty, before the notifier of the stream is enabled
+     */
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &TrackStream::sendData, Qt::QueuedConnection);
+
+    /* The descriptor of the socket is about to be closed */
+    connect(m_socket, &QIODevice::aboutToClose, this, &TrackStream::stop);
+}
+
+TrackStream::~TrackStream()
+{
+    ::close(m_fd);
+}
+
+void TrackStream::start()
+{
+    m_clock.start();
+    sendData();
+}
+
+void TrackStream::sendData()
+{
+    if (m_done || !m_clock.isValid() || m_throttleTimer.isActive())
+    {
+        return;
+    }
+
+    /* Wait until the socket has sent the headers (and the previous responses) */
+    if (m_zeroCopy && m_socket->bytesToWrite() > 0)
+    {
+        m_notifier->setEnabled(false);
+        return;
+    }
+    if (!m_zeroCopy && m_socket->bytesToWrite() >= chunkSize)
+    {
+        return;
+    }
+
+    qint64 length = qMin(m_remaining, chunkSize);
+    if (m_bandwidth > 0)
+    {
+        qint64 elapsed = m_clock.elapsed();
+        qint64 credit = elapsed * m_bandwidth / 1000 - m_sent;
+        if (credit > m_bandwidth)
+        {
+            /* The client was slower than the cap: no burst to catch up */
+            m_clock.restart();
+            m_sent = 0;
+        }
+        else if (credit < 0)
+        {
+            if (m_notifier)
+            {
+                m_notifier->setEnabled(false);
+            }
+            m_throttleTimer.start(-credit * 1000 / m_bandwidth + 1);
+            return;
+        }
+        /* About 10 chunks per second */
+        length = qMin(length, qMax((qint64)4096, (qint64)m_bandwidth / 10));
+    }
+
+    qint64 sent = m_zeroCopy ? sendFile(length) : copyFile(length);
+    if (sent < 0)
+    {
+        finish(false);
+        return;
+    }
+    m_offset += sent;
+    m_remaining -= sent;
+    m_sent += sent;
+
+    if (m_remaining == 0)
+    {
+        finish(true);
+        return;
+    }
+
+    /* Next chunk when the socket is writable again */
+    if (m_zeroCopy)
+    {
+        m_notifier->setEnabled(true);
+    }
+}
+
+/* Return the number of bytes sent (0 if the socket is full), or -1 on error */
+qint64 TrackStream::sendFile(qint64 length)
+{
+#ifdef Q_OS_LINUX
+    off_t offset = m_offset;
+    ssize_t sent = ::sendfile(m_socket->socketDescriptor(), m_fd, &offset, length);
+    if (sent < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+        {
+            return 0;
+        }
+        if (errno == EINVAL || errno == ENOSYS)
+        {
+            /* File system without sendfile() support */
+            qDebug() << "TrackStream: sendfile not supported (" << strerror(errno) << "), copy the file";
+            m_zeroCopy = false;
+            m_notifier->setEnabled(false);
+            return copyFile(length);
+        }
+        qDebug() << "TrackStream: error sending the file (" << strerror(errno) << ")";
+        return -1;
+    }
+    if (sent == 0)
+    {
+        qDebug() << "TrackStream: the file has been truncated";
+        return -1;
+    }
+    return sent;
+#else
+    return copyFile(length);
+#endif
+}
+
+/* Return the number of bytes given to the socket, or -1 on error */
+qint64 TrackStream::copyFile(qint64 length)
+{
+    QByteArray buffer(length, 0);
+    ssize_t size = ::pread(m_fd, buffer.data(), length, m_offset);
+    if (size <= 0)
+    {
+        qDebug() << "TrackStream: error reading the file (" << (size < 0 ? strerror(errno) : "truncated") << ")";
+        return -1;
+    }
+    if (m_socket->write(buffer.constData(), size) != size)
+    {
+        qCritical() << "TrackStream: writing error";
+        return -1;
+    }
+    return size;
+}
+
+void TrackStream::stop()
+{
+    m_done = true;
+    m_throttleTimer.stop();
+    if (m_notifier)
+    {
+        m_notifier->setEnabled(false);
+    }
+}
+
+void TrackStream::finish(bool success)
+{
+    stop();
+    emit finished(success);
+}
@@ -0,0 +1,55 @@
+#ifndef TRACKSTREAM_H
+#define TRACKSTREAM_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QTimer>
+
+/* Body of a /track/<id> response: a range of an audio file sent to the
+ * socket of an HttpClient, after its headers.
+ * On Linux, the file is sent with sendfile(): the data don't go through
+ * user space. The socket is non blocking, the stream sends one chunk each
+ * time it is writable, so that one thread serves many streams at the same
+ * time. Elsewhere (or if sendfile() is refused) the chunks are read and
+ * written to the QTcpSocket.
+ * bandwidth (bytes/s, 0 for no limit) caps the throughput of the stream.
+ * The stream owns the file descriptor.
+ */
+class TrackStream : public QObject
+{
+    Q_OBJECT
+public:
+    TrackStream(QTcpSocket *socket, int fd, qint64 offset, qint64 length, int bandwidth, QObject *parent);
+    ~TrackStream();
+
+private:
+    QTcpSocket *m_socket;
+    int m_fd;
+    qint64 m_offset;
+    qint64 m_remaining;
+    int m_bandwidth;
+    bool m_zeroCopy;
+    bool m_done;
+    QSocketNotifier *m_notifier;
+    QTimer m_throttleTimer;
+    QElapsedTimer m_clock;
+    qint64 m_sent; /* Since m_clock was started */
+
+    qint64 sendFile(qint64 length);
+    qint64 copyFile(qint64 length);
+    void finish(bool success);
+
+signals:
+    void finished(bool success);
+
+public slots:
+    void start();
+
+private slots:
+    void sendData();
+    void stop();
+};
+
+#endif // TRACKSTREAM_H
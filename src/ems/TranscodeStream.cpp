@@ -0,0 +1,278 @@
+#include <QDebug>
+#include <math.h>
+
+#include "TranscodeStream.h"
+
+/* Frames decoded in one go */
+#define TRANSCODE_BLOCK_FRAMES 4096
+/* Data waiting in the socket before the next block is encoded */
+#define TRANSCODE_SOCKET_BUFFER (64*1024)
+
+TranscodeStream::TranscodeStream(QTcpSocket *socket, SNDFILE *sndFile, const SF_INFO &info,
+                                 int outRate, int outBits, bool chunked, QObject *parent) :
+    QObject(parent),
+    m_socket(socket),
+    m_sndFile(sndFile),
+    m_info(info),
+    m_outRate(outRate),
+    m_outBits(outBits),
+    m_chunked(chunked),
+    m_done(false),
+    m_scheduled(false),
+    m_random(0x12345678),
+    m_resampler(NULL)
+{
+    if (m_outRate != m_info.samplerate)
+    {
+        m_resampler = new Resampler(m_info.samplerate, m_outRate, m_info.channels);
+    }
+
+    /* Rounding a resampled signal or removing bits makes a distortion */
+    m_dither = m_resampler || m_outBits < sourceBits(m_info);
+
+    m_input.resize(TRANSCODE_BLOCK_FRAMES * m_info.channels);
+    m_encoder.m_output = &m_output;
+
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &TranscodeStream::sendData);
+
+    /* The descriptor of the socket is about to be closed */
+    connect(m_socket, &QIODevice::aboutToClose, this, &TranscodeStream::stop);
+}
+
+TranscodeStream::~TranscodeStream()
+{
+    /* The encoder is finished by its destructor, after m_output */
+    m_encoder.m_output = NULL;
+    delete m_resampler;
+    sf_close(m_sndFile);
+}
+
+/* Bits of the decoded samples: FLAC can't have more than 24 */
+int TranscodeStream::sourceBits(const SF_INFO &info)
+{
+    switch (info.format & SF_FORMAT_SUBMASK)
+    {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+            return 8;
+        case SF_FORMAT_PCM_16:
+            return 16;
+        default:
+            return 24;
+    }
+}
+
+/* PCM samples: the bits of the file are meaningful */
+bool TranscodeStream::isLossless(const SF_INFO &info)
+{
+    switch (info.format & SF_FORMAT_SUBMASK)
+    {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+        case SF_FORMAT_PCM_16:
+        case SF_FORMAT_PCM_24:
+        case SF_FORMAT_PCM_32:
+        case SF_FORMAT_FLOAT:
+        case SF_FORMAT_DOUBLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool TranscodeStream::initialize()
+{
+    bool ok = true;
+
+    ok &= m_encoder.set_verify(false);
+    ok &= m_encoder.set_compression_level(5);
+    ok &= m_encoder.set_channels(m_info.channels);
+    ok &= m_encoder.set_bits_per_sample(m_outBits);
+    ok &= m_encoder.set_sample_rate(m_outRate);
+    ok &= m_encoder.set_total_samples_estimate((FLAC__uint64)m_info.frames * m_outRate / m_info.samplerate);
+    if (!ok)
+    {
+        qCritical() << "TranscodeStream: Flac encoder configuration failed";
+        return false;
+    }
+
+    FLAC__StreamEncoderInitStatus status = m_encoder.init();
+    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+    {
+        qCritical() << "TranscodeStream: ERROR: initializing encoder: "
+                    << FLAC__StreamEncoderInitStatusString[status];
+        return false;
+    }
+    return true;
+}
+
+void TranscodeStream::start()
+{
+    sendData();
+}
+
+/* Encode one block, then let the other connections of the thread run */
+void TranscodeStream::sendData()
+{
+    m_scheduled = false;
+    if (m_done || m_socket->bytesToWrite() >= TRANSCODE_SOCKET_BUFFER)
+    {
+        return;
+    }
+
+    sf_count_t nbFrames = sf_readf_float(m_sndFile, m_input.data(), TRANSCODE_BLOCK_FRAMES);
+    if (nbFrames <= 0)
+    {
+        if (sf_error(m_sndFile) != SF_ERR_NO_ERROR)
+        {
+            qDebug() << "TranscodeStream: decoding error (" << sf_strerror(m_sndFile) << ")";
+            finish(false);
+            return;
+        }
+
+        /* End of the file */
+        bool ok = true;
+        if (m_resampler)
+        {
+            m_resampled.resize(0);
+            m_resampler->flush(&m_resampled);
+            ok = encode(m_resampled.constData(), m_resampled.size() / m_info.channels);
+        }
+        ok &= m_encoder.finish();
+        if (!ok)
+        {
+            qCritical() << "TranscodeStream: encoding error";
+            finish(false);
+            return;
+        }
+        sendOutput(true);
+        finish(true);
+        return;
+    }
+
+    bool ok;
+    if (m_resampler)
+    {
+        m_resampled.resize(0);
+        m_resampler->process(m_input.constData(), nbFrames, &m_resampled);
+        ok = encode(m_resampled.constData(), m_resampled.size() / m_info.channels);
+    }
+    else
+    {
+        ok = encode(m_input.constData(), nbFrames);
+    }
+    if (!ok)
+    {
+        qCritical() << "TranscodeStream: encoding error ("
+                    << m_encoder.get_state().resolved_as_cstring(m_encoder) << ")";
+        finish(false);
+        return;
+    }
+    sendOutput(false);
+
+    if (m_socket->bytesToWrite() < TRANSCODE_SOCKET_BUFFER && !m_scheduled)
+    {
+        /* The encoder keeps the samples until a FLAC frame is complete */
+        m_scheduled = true;
+        QMetaObject::invokeMethod(this, "sendData", Qt::QueuedConnection);
+    }
+}
+
+/* Requantize the samples to m_outBits and give them to the encoder */
+bool TranscodeStream::encode(const float *samples, int nbFrames)
+{
+    if (nbFrames <= 0)
+    {
+        return true;
+    }
+
+    int nbSamples = nbFrames * m_info.channels;
+    float scale = (float)(1 << (m_outBits - 1));
+    float maxValue = scale - 1.0f;
+    m_pcm.resize(nbSamples);
+    FLAC__int32 *pcm = m_pcm.data();
+
+    for (int i=0; i<nbSamples; i++)
+    {
+        float value = samples[i] * scale;
+        if (m_dither)
+        {
+            /* TPDF dither of +/- 1 LSB: sum of two uniform noises */
+            m_random ^= m_random << 13; m_random ^= m_random >> 17; m_random ^= m_random << 5;
+            float noise = (m_random >> 8) * (1.0f / 16777216.0f);
+            m_random ^= m_random << 13; m_random ^= m_random >> 17; m_random ^= m_random << 5;
+            noise -= (m_random >> 8) * (1.0f / 16777216.0f);
+            value += noise;
+        }
+        value = floorf(value + 0.5f);
+        if (value > maxValue)
+        {
+            value = maxValue;
+        }
+        else if (value < -scale)
+        {
+            value = -scale;
+        }
+        pcm[i] = (FLAC__int32)value;
+    }
+
+    return m_encoder.process_interleaved(pcm, nbFrames);
+}
+
+/* Send the FLAC frames made since the last call */
+void TranscodeStream::sendOutput(bool last)
+{
+    QByteArray data;
+
+    if (!m_output.isEmpty())
+    {
+        if (m_chunked)
+        {
+            data = QByteArray::number(m_output.size(), 16) + "\r\n" + m_output + "\r\n";
+        }
+        else
+        {
+            data = m_output;
+        }
+        m_output.resize(0);
+    }
+    if (last && m_chunked)
+    {
+        data += "0\r\n\r\n";
+    }
+
+    if (!data.isEmpty() && m_socket->write(data) != data.size())
+    {
+        qCritical() << "TranscodeStream: writing error";
+    }
+}
+
+void TranscodeStream::stop()
+{
+    m_done = true;
+}
+
+void TranscodeStream::finish(bool success)
+{
+    stop();
+    emit finished(success);
+}
+
+TranscodeStream::InternalFlacEncoder::InternalFlacEncoder()
+    : FLAC::Encoder::Stream()
+{
+    m_output = NULL;
+}
+
+::FLAC__StreamEncoderWriteStatus TranscodeStream::InternalFlacEncoder::write_callback(const FLAC__byte buffer[], size_t bytes,
+                                                                                      unsigned samples, unsigned current_frame)
+{
+    Q_UNUSED(samples);
+    Q_UNUSED(current_frame);
+
+    if (m_output)
+    {
+        m_output->append((const char *)buffer, bytes);
+    }
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
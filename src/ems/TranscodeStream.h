@@ -0,0 +1,79 @@
+#ifndef TRANSCODESTREAM_H
+#define TRANSCODESTREAM_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QByteArray>
+#include <QVector>
+#include <FLAC++/encoder.h>
+#include <sndfile.h>
+
+#include "Resampler.h"
+
+/* Body of a transcoded /track/<id> response: the file is decoded with
+ * libsndfile, resampled to outRate (if needed), requantized to outBits
+ * (with a TPDF dither if bits are removed) and encoded in FLAC on the fly.
+ * The length is not known: the FLAC stream is sent with the chunked
+ * transfer encoding (or until the connection is closed for an HTTP/1.0
+ * client).
+ * One block is encoded only when the socket has sent the previous data:
+ * the memory used by a stream does not depend on the client speed.
+ */
+class TranscodeStream : public QObject
+{
+    class InternalFlacEncoder : public FLAC::Encoder::Stream
+    {
+        public:
+            InternalFlacEncoder();
+            QByteArray *m_output;
+        protected:
+            virtual ::FLAC__StreamEncoderWriteStatus write_callback(const FLAC__byte buffer[], size_t bytes,
+                                                                    unsigned samples, unsigned current_frame);
+    };
+
+    Q_OBJECT
+public:
+    TranscodeStream(QTcpSocket *socket, SNDFILE *sndFile, const SF_INFO &info,
+                    int outRate, int outBits, bool chunked, QObject *parent);
+    ~TranscodeStream();
+
+    bool initialize();
+
+    static int sourceBits(const SF_INFO &info);
+    static bool isLossless(const SF_INFO &info);
+
+private:
+    QTcpSocket *m_socket;
+    SNDFILE *m_sndFile;
+    SF_INFO m_info;
+    int m_outRate;
+    int m_outBits;
+    bool m_chunked;
+    bool m_dither;
+    bool m_done;
+    bool m_scheduled; /* A call of sendData() is queued */
+    quint32 m_random; /* State of the dither noise */
+
+    Resampler *m_resampler;
+    InternalFlacEncoder m_encoder;
+    QVector<float> m_input;
+    QVector<float> m_resampled;
+    QVector<FLAC__int32> m_pcm;
+    QByteArray m_output;
+
+    bool encode(const float *samples, int nbFrames);
+    void sendOutput(bool last);
+    void finish(bool success);
+
+signals:
+    void finished(bool success);
+
+public slots:
+    void start();
+
+private slots:
+    void sendData();
+    void stop();
+};
+
+#endif // TRANSCODESTREAM_H
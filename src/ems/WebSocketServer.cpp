@@ -4,6 +4,7 @@
 #include "WebSocketServer.h"
 #include "Player.h"
 #include "CdromManager.h"
+#include "ScanMonitor.h"
 
 WebSocketServer::WebSocketServer(quint16 port, QObject *parent) :
         QObject(parent),
@@ -24,6 +25,8 @@ WebSocketServer::WebSocketServer(quint16 port, QObject *parent) :
               this, &WebSocketServer::broadcastPlaylist);
       connect(CdromManager::instance(), &CdromManager::ripProgressChanged,
               this, &WebSocketServer::broadcastRipProgress);
+      connect(ScanMonitor::instance(), &ScanMonitor::scanProgressChanged,
+              this, &WebSocketServer::broadcastScanProgress);
       connect(CdromManager::instance(), &CdromManager::cdromInserted,
               this, &WebSocketServer::broadcastMenuChange);
       connect(CdromManager::instance(), &CdromManager::cdromEjected,
@@ -89,6 +92,17 @@ void WebSocketServer::broadcastRipProgress(EMSRipProgress ripProgress)
     }
 }
 
+void WebSocketServer::broadcastScanProgress(EMSScanProgress scanProgress)
+{
+    foreach( JsonApi *api, m_clients.values() )
+    {
+        if (api)
+        {
+            api->sendScanProgress(scanProgress);
+        }
+    }
+}
+
 void WebSocketServer::broadcastMenuChange(EMSCdrom cdromChanged)
 {
     Q_UNUSED(cdromChanged)
@@ -28,6 +28,7 @@ private Q_SLOTS:
     void broadcastPlaylist(EMSPlaylist newPlaylist);
     void broadcastStatus(EMSPlayerStatus newStatus);
     void broadcastRipProgress(EMSRipProgress ripProgress);
+    void broadcastScanProgress(EMSScanProgress scanProgress);
     void broadcastMenuChange(EMSCdrom cdromChanged);
     void broadcastWifiConnected();
     void broadcastEthConnected();
@@ -19,6 +19,9 @@ INCLUDEPATH +=
 
 # Input
 HEADERS += Database.h \
+           DirectoryQueue.h \
+           FileProbe.h \
+           ProbeEngine.h \
            DirectoryWorker.h \
            DiscoveryServer.h \
            sha1.h \
@@ -34,14 +37,23 @@ HEADERS += Database.h \
            HttpServer.h \
            external/http-parser/http_parser.h \
            HttpClient.h \
+           ImageCache.h \
+           TrackStream.h \
+           TranscodeStream.h \
+           Resampler.h \
+           IngestionQueue.h \
            MetadataManager.h \
            MetadataPlugin.h \
            FlacPlugin.h \
            LocalFileScanner.h \
+           ScanMonitor.h \
+           ScanThrottle.h \
            DirectoriesWatcher.h \
            SndfilePlugin.h \
            DsdPlugin.h \
            CoverLocalPlugin.h \
+           CoverStore.h \
+           CoverAtlas.h \
            WavEncoder.h \
            FlacEncoder.h \
            TagLibPlugin.h \
@@ -49,6 +61,9 @@ HEADERS += Database.h \
            Networkctl.h
 
 SOURCES += Database.cpp \
+           DirectoryQueue.cpp \
+           FileProbe.cpp \
+           ProbeEngine.cpp \
            DirectoryWorker.cpp \
            DiscoveryServer.cpp \
            main.cpp \
@@ -62,13 +77,22 @@ SOURCES += Database.cpp \
            HttpServer.cpp \
            external/http-parser/http_parser.c \
            HttpClient.cpp \
+           ImageCache.cpp \
+           TrackStream.cpp \
+           TranscodeStream.cpp \
+           Resampler.cpp \
+           IngestionQueue.cpp \
            MetadataManager.cpp \
            FlacPlugin.cpp \
            LocalFileScanner.cpp \
+           ScanMonitor.cpp \
+           ScanThrottle.cpp \
            DirectoriesWatcher.cpp \
            SndfilePlugin.cpp \
            DsdPlugin.cpp \
            CoverLocalPlugin.cpp \
+           CoverStore.cpp \
+           CoverAtlas.cpp \
            WavEncoder.cpp \
            FlacEncoder.cpp \
            TagLibPlugin.cpp \
@@ -121,6 +145,20 @@ equals(EMS_PLUGIN_GRACENOTE, "yes") {
     message("Use libcdio paranoia header in $$LIBCDIO_INCLUDE_PATH")
 }
 
+# Native inotify backend of the DirectoriesWatcher (QFileSystemWatcher is used otherwise)
+linux {
+    HEADERS += InotifyWatcher.h
+    SOURCES += InotifyWatcher.cpp
+    DEFINES += EMS_INOTIFY_WATCHER
+}
+
+# io_uring backend of the ProbeEngine (a thread pool is used otherwise)
+equals(EMS_FEATURE_IOURING, "yes") {
+    message("Enable io_uring probe engine")
+    DEFINES += EMS_FEATURE_IOURING
+    PKGCONFIG += liburing
+}
+
 # For Mac OS taglib package, package config give path with /taglib...
 macx {
     TAGLIB_INCLUDE_PATH = "$$system(pkg-config taglib --variable=includedir)"
@@ -24,6 +24,21 @@
 #include "sha1.h"
 #include <string.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_X86_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__)
+#define SHA1_ARM_CRYPTO
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 
 /* static uint16_t bswap_16(uint16_t x) */
 /* { */
@@ -136,6 +151,259 @@ static void transform(uint32_t state[5], const uint8_t buffer[64]){
     state[4] += e;
 }
 
+/* Hash several consecutive blocks */
+typedef void (*transform_func)(uint32_t state[5], const uint8_t* data, unsigned int blocks);
+
+static void transform_c(uint32_t state[5], const uint8_t* data, unsigned int blocks){
+    while (blocks--) {
+        transform(state, data);
+        data += 64;
+    }
+}
+
+#ifdef SHA1_X86_SHANI
+/* Intel SHA extensions: 4 rounds per sha1rnds4.
+ * The state is kept as ABCD (reversed in one register) and E.
+ */
+#define SHANI_ROUNDS(E_IN, E_OUT, M_CUR, M_NEXT, M_XOR, M_MSG1, F) \
+    E_IN = _mm_sha1nexte_epu32(E_IN, M_CUR);                      \
+    E_OUT = abcd;                                                 \
+    M_NEXT = _mm_sha1msg2_epu32(M_NEXT, M_CUR);                   \
+    abcd = _mm_sha1rnds4_epu32(abcd, E_IN, F);                    \
+    M_MSG1 = _mm_sha1msg1_epu32(M_MSG1, M_CUR);                   \
+    M_XOR = _mm_xor_si128(M_XOR, M_CUR);
+
+__attribute__((target("sha,sse4.1")))
+static void transform_shani(uint32_t state[5], const uint8_t* data, unsigned int blocks){
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1, msg0, msg1, msg2, msg3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        /* Rounds 0-11: load the message */
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+
+        /* Rounds 12-75: the message schedule runs with the rounds */
+        SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+        SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+        SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+        SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+        SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+        SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+        SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+        SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+        SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+        SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+        SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 3);
+        SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 3);
+
+        /* Rounds 76-79 */
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        data += 64;
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static int has_shani(void){
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0; /* SHA */
+}
+#endif
+
+#ifdef SHA1_ARM_CRYPTO
+/* ARMv8 crypto extensions: 4 rounds per sha1c/sha1p/sha1m.
+ * TMP holds the message words of the next rounds, with their constant.
+ */
+#define ARM_ROUNDS(OP, E_CUR, E_NEXT, TMP)              \
+    E_NEXT = vsha1h_u32(vgetq_lane_u32(abcd, 0));       \
+    abcd = OP(abcd, E_CUR, TMP);
+
+#ifdef __clang__
+__attribute__((target("crypto")))
+#else
+__attribute__((target("+crypto")))
+#endif
+static void transform_arm(uint32_t state[5], const uint8_t* data, unsigned int blocks){
+    const uint32x4_t k0 = vdupq_n_u32(0x5A827999);
+    const uint32x4_t k1 = vdupq_n_u32(0x6ED9EBA1);
+    const uint32x4_t k2 = vdupq_n_u32(0x8F1BBCDC);
+    const uint32x4_t k3 = vdupq_n_u32(0xCA62C1D6);
+    uint32x4_t abcd, abcd_save, tmp0, tmp1, msg0, msg1, msg2, msg3;
+    uint32_t e0, e0_save, e1;
+
+    abcd = vld1q_u32(&state[0]);
+    e0 = state[4];
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        msg0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+        msg1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+        msg2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+        msg3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+        tmp0 = vaddq_u32(msg0, k0);
+        tmp1 = vaddq_u32(msg1, k0);
+
+        /* Rounds 0-19 */
+        ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg2, k0);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg3, k0);
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg0, k0);
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg1, k1);
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg2, k1);
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+        /* Rounds 20-39 */
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg3, k1);
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg0, k1);
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg1, k1);
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg2, k2);
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg3, k2);
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+
+        /* Rounds 40-59 */
+        ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg0, k2);
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg1, k2);
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg2, k2);
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg3, k3);
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg0, k3);
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+
+        /* Rounds 60-79 */
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg1, k3);
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0);
+        tmp0 = vaddq_u32(msg2, k3);
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+        tmp1 = vaddq_u32(msg3, k3);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1);
+
+        e0 += e0_save;
+        abcd = vaddq_u32(abcd_save, abcd);
+
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], abcd);
+    state[4] = e0;
+}
+
+static int has_arm_sha1(void){
+#if defined(__APPLE__)
+    return 1;
+#elif defined(__linux__) && defined(HWCAP_SHA1)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#else
+    return 0;
+#endif
+}
+#endif
+
+/* Chosen once, when the program is loaded. All the implementations give
+ * the same digests.
+ */
+static transform_func select_transform(void){
+#ifdef SHA1_X86_SHANI
+    if (has_shani())
+        return transform_shani;
+#endif
+#ifdef SHA1_ARM_CRYPTO
+    if (has_arm_sha1())
+        return transform_arm;
+#endif
+    return transform_c;
+}
+
+static const transform_func transform_blocks = select_transform();
+
 void sha1_init(SHA1* ctx){
     ctx->state[0] = 0x67452301;
     ctx->state[1] = 0xEFCDAB89;
@@ -161,9 +429,10 @@ void sha1_update(SHA1* ctx, const uint8_t* data, unsigned int len){
 #else
     if ((j + len) > 63) {
         memcpy(&ctx->buffer[j], data, (i = 64-j));
-        transform(ctx->state, ctx->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            transform(ctx->state, &data[i]);
+        transform_blocks(ctx->state, ctx->buffer, 1);
+        if ((len - i) >= 64) {
+            transform_blocks(ctx->state, &data[i], (len - i) / 64);
+            i += (len - i) & ~63;
         }
         j=0;
     }